@@ -0,0 +1,321 @@
+/*
+Micro-benchmarks of the simulation kernels: Cube::computeInternalForce in every force mode, Integrator::integrate of
+every integrator, Terrain::handleCollision of every terrain and MassSpringSystem::checkStable, each over a range of
+particleCountPerEdge values. Every measurement runs warmup calls, then timed repetitions until either the repetition
+count or the time budget is reached, and reports the median and 95th percentile of the single call times.
+
+Usage: benchmark [--option value]..., see printUsage for the options.
+*/
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "src/simulation.h"
+#include "src/util/filesystem.h"
+#include "src/util/threadPool.h"
+
+namespace {
+struct Options {
+    std::vector<int> sizes = {5, 10, 20, 40, 80};
+    int warmup = 3;
+    int repetitions = 30;
+    double budget = 2.0;  // seconds of timed calls per measurement
+    std::string filter;   // only run measurements whose name contains it
+    std::string jsonPath;
+};
+
+struct Result {
+    std::string name;
+    int particleCountPerEdge;
+    int repetitions;
+    double median;  // microseconds
+    double p95;
+    double min;
+    double mean;
+};
+
+// a measurement left out on purpose, reported rather than silently missing
+struct Skip {
+    std::string name;
+    int particleCountPerEdge;
+    std::string reason;
+};
+
+// Projective dynamics factors the system matrix of the whole cube, which takes minutes past 40 particles per edge,
+// larger sizes are reported as skipped
+constexpr struct {
+    const char* name;
+    simulation::IntegratorType type;
+    int maxParticleCountPerEdge;
+} integratorNames[] = {
+    {"ExplicitEuler", simulation::IntegratorType::ExplicitEuler, 1 << 10},
+    {"ImplicitEuler", simulation::IntegratorType::ImplicitEuler, 1 << 10},
+    {"MidpointEuler", simulation::IntegratorType::MidpointEuler, 1 << 10},
+    {"RungeKuttaFourth", simulation::IntegratorType::RungeKuttaFourth, 1 << 10},
+    {"BackwardEuler", simulation::IntegratorType::BackwardEuler, 1 << 10},
+    {"ProjectiveDynamics", simulation::IntegratorType::ProjectiveDynamics, 40},
+    {"XPBD", simulation::IntegratorType::XPBD, 1 << 10},
+    {"DormandPrince", simulation::IntegratorType::DormandPrince, 1 << 10},
+};
+
+constexpr struct {
+    const char* name;
+    simulation::TerrainType type;
+} terrainNames[] = {
+    {"Plane", simulation::TerrainType::Plane},
+    {"Sphere", simulation::TerrainType::Sphere},
+    {"Bowl", simulation::TerrainType::Bowl},
+    {"TiltedPlane", simulation::TerrainType::TiltedPlane},
+    {"Heightfield", simulation::TerrainType::Heightfield},
+};
+
+constexpr struct {
+    const char* name;
+    simulation::ForceMode mode;
+} forceModeNames[] = {
+    {"Scatter", simulation::ForceMode::Scatter},
+    {"Colored", simulation::ForceMode::Colored},
+    {"Gather", simulation::ForceMode::Gather},
+};
+
+void printUsage(const char* program) {
+    const Options defaults;
+    std::cout << "Usage: " << program << " [--option value]...\n"
+              << "  --sizes N,N,...     particles per cube edge to measure (5,10,20,40,80), ProjectiveDynamics\n"
+              << "                      is only measured up to 40 and reported as skipped past it\n"
+              << "  --warmup N          untimed calls before every measurement (" << defaults.warmup << ")\n"
+              << "  --repetitions N     timed calls per measurement at most (" << defaults.repetitions << ")\n"
+              << "  --budget SECONDS    time after which a measurement stops, past 3 calls (" << defaults.budget
+              << ")\n"
+              << "  --filter TEXT       only run measurements whose name contains TEXT\n"
+              << "  --json PATH         also write the results as JSON to PATH, - for standard output, which\n"
+              << "                      moves the table to standard error\n";
+}
+
+// throws std::invalid_argument or std::out_of_range on malformed options
+Options parseOptions(const int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string option = argv[i];
+        const auto value = [&]() -> std::string {
+            if (i + 1 >= argc) throw std::invalid_argument("missing value of " + option);
+            return argv[++i];
+        };
+        if (option == "--sizes") {
+            options.sizes.clear();
+            std::stringstream list(value());
+            std::string size;
+            while (std::getline(list, size, ',')) {
+                options.sizes.push_back(std::stoi(size));
+                if (options.sizes.back() < 2) throw std::invalid_argument("--sizes must be at least 2");
+            }
+            if (options.sizes.empty()) throw std::invalid_argument("--sizes is empty");
+        } else if (option == "--warmup") {
+            options.warmup = std::max(std::stoi(value()), 0);
+        } else if (option == "--repetitions") {
+            options.repetitions = std::max(std::stoi(value()), 1);
+        } else if (option == "--budget") {
+            options.budget = std::stod(value());
+        } else if (option == "--filter") {
+            options.filter = value();
+        } else if (option == "--json") {
+            options.jsonPath = value();
+        } else {
+            throw std::invalid_argument("unknown option " + option);
+        }
+    }
+    return options;
+}
+
+class Harness {
+ public:
+    // the table of results goes to out
+    Harness(const Options& options, std::ostream& out) : options(options), out(out) {}
+
+    const std::vector<Result>& getResults() const { return results; }
+    const std::vector<Skip>& getSkipped() const { return skipped; }
+
+    // list name as not measured at particleCountPerEdge for reason, unless name is filtered out
+    void skip(const std::string& name, const int particleCountPerEdge, const std::string& reason) {
+        if (name.find(options.filter) == std::string::npos) return;
+        out << std::left << std::setw(40) << name << std::right << std::setw(5) << particleCountPerEdge
+            << "  skipped, " << reason << std::endl;
+        skipped.push_back({name, particleCountPerEdge, reason});
+    }
+
+    // time function(), the single call being the unit, unless name is filtered out
+    template <typename Function>
+    void measure(const std::string& name, const int particleCountPerEdge, const Function& function) {
+        using clock = std::chrono::steady_clock;
+        // minimum number of timed calls, whatever the budget
+        constexpr int minRepetitions = 3;
+        if (name.find(options.filter) == std::string::npos) return;
+
+        // warmup shares the budget, a single call may exceed it
+        clock::time_point start = clock::now();
+        for (int i = 0; i < options.warmup; ++i) {
+            function();
+            if (std::chrono::duration<double>(clock::now() - start).count() > options.budget) break;
+        }
+        std::vector<double> times;
+        times.reserve(options.repetitions);
+        start = clock::now();
+        while (static_cast<int>(times.size()) < options.repetitions) {
+            const clock::time_point begin = clock::now();
+            function();
+            const clock::time_point end = clock::now();
+            times.push_back(std::chrono::duration<double, std::micro>(end - begin).count());
+            if (static_cast<int>(times.size()) >= minRepetitions &&
+                std::chrono::duration<double>(end - start).count() > options.budget) {
+                break;
+            }
+        }
+
+        std::sort(times.begin(), times.end());
+        const int count = static_cast<int>(times.size());
+        Result result;
+        result.name = name;
+        result.particleCountPerEdge = particleCountPerEdge;
+        result.repetitions = count;
+        result.median = count % 2 ? times[count / 2] : 0.5 * (times[count / 2 - 1] + times[count / 2]);
+        // nearest rank
+        result.p95 = times[static_cast<int>(std::ceil(0.95 * count)) - 1];
+        result.min = times.front();
+        result.mean = 0.0;
+        for (const double time : times) result.mean += time / count;
+        print(out, result);
+        results.push_back(result);
+    }
+
+ private:
+    const Options& options;
+    std::ostream& out;
+    std::vector<Result> results;
+    std::vector<Skip> skipped;
+
+    static void print(std::ostream& stream, const Result& result) {
+        stream << std::left << std::setw(40) << result.name << std::right << std::setw(5)
+               << result.particleCountPerEdge << std::setw(6) << result.repetitions << std::fixed
+               << std::setprecision(3) << std::setw(14) << result.median << std::setw(14) << result.p95
+               << std::setw(14) << result.min << std::setw(14) << result.mean << std::defaultfloat << std::endl;
+    }
+};
+
+void writeJSON(std::ostream& out, const std::vector<Result>& results, const std::vector<Skip>& skipped) {
+    out << "{\n  \"threads\": " << util::ThreadPool::getInstance().getThreadCount() << ",\n  \"unit\": \"us\",\n"
+        << "  \"results\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& result = results[i];
+        out << (i ? "," : "") << "\n    {\"name\": \"" << result.name
+            << "\", \"particleCountPerEdge\": " << result.particleCountPerEdge
+            << ", \"repetitions\": " << result.repetitions << std::setprecision(6) << ", \"median\": " << result.median
+            << ", \"p95\": " << result.p95 << ", \"min\": " << result.min << ", \"mean\": " << result.mean << "}";
+    }
+    out << "\n  ],\n  \"skipped\": [";
+    for (size_t i = 0; i < skipped.size(); ++i) {
+        out << (i ? "," : "") << "\n    {\"name\": \"" << skipped[i].name
+            << "\", \"particleCountPerEdge\": " << skipped[i].particleCountPerEdge << ", \"reason\": \""
+            << skipped[i].reason << "\"}";
+    }
+    out << "\n  ]\n}" << std::endl;
+}
+
+void runSize(Harness& harness, const int particleCountPerEdge, const bool hasAssets) {
+    simulation::MassSpringSystem particleSystem;
+    particleSystem.particleCountPerEdge = particleCountPerEdge;
+    particleSystem.setCubeCount(1);
+    particleSystem.setTerrain(simulation::TerrainFactory::CreateTerrain(simulation::TerrainType::Plane));
+    simulation::Cube& cube = *particleSystem.getCubePointer(0);
+
+    for (const auto& entry : forceModeNames) {
+        particleSystem.setForceMode(entry.mode);
+        harness.measure(std::string("computeInternalForce/") + entry.name, particleCountPerEdge,
+                        [&cube] { cube.computeInternalForce(); });
+    }
+    particleSystem.setForceMode(simulation::ForceMode::Scatter);
+
+    // collision of the cube at rest in its spawn pose
+    const float deltaTime = particleSystem.deltaTime;
+    for (const auto& entry : terrainNames) {
+        if (entry.type == simulation::TerrainType::Heightfield && !hasAssets) continue;
+        const auto terrain = simulation::TerrainFactory::CreateTerrain(entry.type);
+        harness.measure(std::string("handleCollision/") + entry.name, particleCountPerEdge,
+                        [&terrain, &cube, deltaTime] { terrain->handleCollision(deltaTime, cube); });
+    }
+    const auto sdf = simulation::TerrainFactory::CreateSDFTerrain(simulation::TerrainType::Plane);
+    harness.measure("handleCollision/SDF", particleCountPerEdge,
+                    [&sdf, &cube, deltaTime] { sdf->handleCollision(deltaTime, cube); });
+
+    // One step of the cube falling toward the plane, every integrator starting from the spawn pose. DormandPrince
+    // only steps once its time budget exceeds its step size, many of its calls return at once; compare its mean.
+    for (const auto& entry : integratorNames) {
+        if (particleCountPerEdge > entry.maxParticleCountPerEdge) {
+            harness.skip(std::string("integrate/") + entry.name, particleCountPerEdge,
+                         "too slow past " + std::to_string(entry.maxParticleCountPerEdge) + " particles per edge");
+            continue;
+        }
+        particleSystem.reset();
+        const auto integrator = simulation::IntegratorFactory::CreateIntegrator(entry.type);
+        integrator->bindTerrain(simulation::TerrainType::Plane);
+        harness.measure(std::string("integrate/") + entry.name, particleCountPerEdge,
+                        [&integrator, &particleSystem] { integrator->integrate(particleSystem); });
+    }
+
+    particleSystem.reset();
+    harness.measure("checkStable", particleCountPerEdge, [&particleSystem] {
+        // keep the result alive so the call is not optimized away
+        volatile bool isStable = particleSystem.checkStable();
+        (void)isStable;
+    });
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "--help" || std::string(argv[i]) == "-h") {
+            printUsage(argv[0]);
+            return 0;
+        }
+    }
+    Options options;
+    try {
+        options = parseOptions(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << "Invalid arguments: " << e.what() << std::endl;
+        printUsage(argv[0]);
+        return 1;
+    }
+    // only the heightfield reads assets
+    const bool hasAssets = util::PathFinder::initialize();
+    if (!hasAssets) std::cerr << "Cannot find assets, skipping the heightfield" << std::endl;
+
+    // JSON on standard output keeps it parseable, the table moves to standard error
+    std::ostream& table = options.jsonPath == "-" ? std::cerr : std::cout;
+    table << std::left << std::setw(26) << "Threads"
+          << ": " << util::ThreadPool::getInstance().getThreadCount() << std::endl;
+    table << std::left << std::setw(40) << "name" << std::right << std::setw(5) << "edge" << std::setw(6) << "reps"
+          << std::setw(14) << "median us" << std::setw(14) << "p95 us" << std::setw(14) << "min us" << std::setw(14)
+          << "mean us" << std::endl;
+    Harness harness(options, table);
+    for (const int size : options.sizes) runSize(harness, size, hasAssets);
+
+    if (options.jsonPath == "-") {
+        writeJSON(std::cout, harness.getResults(), harness.getSkipped());
+    } else if (!options.jsonPath.empty()) {
+        std::ofstream file(options.jsonPath);
+        if (!file) {
+            std::cerr << "Cannot open " << options.jsonPath << std::endl;
+            return 1;
+        }
+        writeJSON(file, harness.getResults(), harness.getSkipped());
+    }
+    return 0;
+}
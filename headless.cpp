@@ -0,0 +1,299 @@
+/*
+Headless soft body simulation: runs one scene for a number of steps without a window and prints timing.
+Only the simulation and utility sources are linked, so it builds and runs on machines without a display.
+
+Usage: headless [--option value]..., see printUsage for the options.
+*/
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "src/simulation.h"
+#include "src/util/clock.h"
+#include "src/util/filesystem.h"
+#include "src/util/threadPool.h"
+#include "src/util/trajectory.h"
+
+namespace {
+struct Options {
+    simulation::IntegratorType integrator = simulation::IntegratorType::ExplicitEuler;
+    simulation::TerrainType terrain = simulation::TerrainType::Plane;
+    bool isUsingSDFTerrain = false;
+    bool isSelfColliding = false;
+    int particleCountPerEdge = 10;
+    int cubeCount = 1;
+    int steps = 1000;
+    float deltaTime = 0.001f;
+    float springCoef = 2000.0f;
+    float damperCoef = 60.0f;
+    std::string loadPath;  // checkpoint replacing the scene options
+    std::string savePath;  // checkpoint written after the last step
+    std::string trajectoryPath;
+    int frameSteps = 8;      // steps between two trajectory frames
+    float restSpeed = 0.0f;  // fail unless every particle ends slower, 0 leaves the speed unchecked
+};
+
+constexpr struct {
+    const char* name;
+    simulation::IntegratorType type;
+} integratorNames[] = {
+    {"ExplicitEuler", simulation::IntegratorType::ExplicitEuler},
+    {"ImplicitEuler", simulation::IntegratorType::ImplicitEuler},
+    {"MidpointEuler", simulation::IntegratorType::MidpointEuler},
+    {"RungeKuttaFourth", simulation::IntegratorType::RungeKuttaFourth},
+    {"BackwardEuler", simulation::IntegratorType::BackwardEuler},
+    {"ProjectiveDynamics", simulation::IntegratorType::ProjectiveDynamics},
+    {"XPBD", simulation::IntegratorType::XPBD},
+    {"DormandPrince", simulation::IntegratorType::DormandPrince},
+};
+
+constexpr struct {
+    const char* name;
+    simulation::TerrainType type;
+} terrainNames[] = {
+    {"Plane", simulation::TerrainType::Plane},
+    {"Sphere", simulation::TerrainType::Sphere},
+    {"Bowl", simulation::TerrainType::Bowl},
+    {"TiltedPlane", simulation::TerrainType::TiltedPlane},
+    {"Heightfield", simulation::TerrainType::Heightfield},
+};
+
+void printUsage(const char* program) {
+    const Options defaults;
+    std::cout << "Usage: " << program << " [--option value]...\n"
+              << "  --integrator NAME   ExplicitEuler (default), ImplicitEuler, MidpointEuler, RungeKuttaFourth,\n"
+              << "                      BackwardEuler, ProjectiveDynamics, XPBD or DormandPrince\n"
+              << "  --terrain NAME      Plane (default), Sphere, Bowl, TiltedPlane or Heightfield\n"
+              << "  --sdf               collide with the sampled signed distance field of the terrain\n"
+              << "  --self-collision    collide cube surfaces with themselves\n"
+              << "  --particles N       particles per cube edge (" << defaults.particleCountPerEdge << ")\n"
+              << "  --cubes N           number of cubes (" << defaults.cubeCount << ")\n"
+              << "  --steps N           time steps to simulate (" << defaults.steps << ")\n"
+              << "  --dt SECONDS        time step (" << defaults.deltaTime << ")\n"
+              << "  --k COEF            spring coefficient of every spring type (" << defaults.springCoef << ")\n"
+              << "  --d COEF            damper coefficient of every spring type (" << defaults.damperCoef << ")\n"
+              << "  --load PATH         resume from a checkpoint, ignoring the scene options above\n"
+              << "  --save PATH         write a checkpoint after the last step\n"
+              << "  --trajectory PATH   record the particle positions to PATH, for playback in the viewer\n"
+              << "  --frame-steps N     steps between two recorded frames (" << defaults.frameSteps << ")\n"
+              << "  --rest-speed SPEED  fail unless every particle ends slower than SPEED, to check that the\n"
+              << "                      scene comes to rest\n";
+}
+
+template <typename Table>
+auto parseName(const Table& table, const std::string& name, const char* option) -> decltype(table[0].type) {
+    for (const auto& entry : table) {
+        if (name == entry.name) return entry.type;
+    }
+    throw std::invalid_argument(std::string("unknown ") + option + " " + name);
+}
+
+int parsePositive(const std::string& value, const char* option) {
+    const int result = std::stoi(value);
+    if (result < 1) throw std::invalid_argument(std::string(option) + " must be positive");
+    return result;
+}
+
+// throws std::invalid_argument or std::out_of_range on malformed options
+Options parseOptions(const int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string option = argv[i];
+        if (option == "--sdf") {
+            options.isUsingSDFTerrain = true;
+            continue;
+        }
+        if (option == "--self-collision") {
+            options.isSelfColliding = true;
+            continue;
+        }
+        const auto value = [&]() -> std::string {
+            if (i + 1 >= argc) throw std::invalid_argument("missing value of " + option);
+            return argv[++i];
+        };
+        if (option == "--integrator") {
+            options.integrator = parseName(integratorNames, value(), "integrator");
+        } else if (option == "--terrain") {
+            options.terrain = parseName(terrainNames, value(), "terrain");
+        } else if (option == "--particles") {
+            options.particleCountPerEdge = parsePositive(value(), "--particles");
+            if (options.particleCountPerEdge < 2) throw std::invalid_argument("--particles must be at least 2");
+        } else if (option == "--cubes") {
+            options.cubeCount = parsePositive(value(), "--cubes");
+        } else if (option == "--steps") {
+            options.steps = parsePositive(value(), "--steps");
+        } else if (option == "--dt") {
+            options.deltaTime = std::stof(value());
+            if (!(options.deltaTime > 0.0f)) throw std::invalid_argument("--dt must be positive");
+        } else if (option == "--k") {
+            options.springCoef = std::stof(value());
+        } else if (option == "--d") {
+            options.damperCoef = std::stof(value());
+        } else if (option == "--load") {
+            options.loadPath = value();
+        } else if (option == "--save") {
+            options.savePath = value();
+        } else if (option == "--trajectory") {
+            options.trajectoryPath = value();
+        } else if (option == "--frame-steps") {
+            options.frameSteps = parsePositive(value(), "--frame-steps");
+        } else if (option == "--rest-speed") {
+            options.restSpeed = std::stof(value());
+            if (!(options.restSpeed > 0.0f)) throw std::invalid_argument("--rest-speed must be positive");
+        } else {
+            throw std::invalid_argument("unknown option " + option);
+        }
+    }
+    return options;
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "--help" || std::string(argv[i]) == "-h") {
+            printUsage(argv[0]);
+            return 0;
+        }
+    }
+    Options options;
+    try {
+        options = parseOptions(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << "Invalid arguments: " << e.what() << std::endl;
+        printUsage(argv[0]);
+        return 1;
+    }
+    // only the heightfield reads assets, a checkpoint reports its own failure to find them
+    if (!options.loadPath.empty()) {
+        util::PathFinder::initialize();
+    } else if (options.terrain == simulation::TerrainType::Heightfield && !util::PathFinder::initialize()) {
+        std::cerr << "Cannot find assets!" << std::endl;
+        return 1;
+    }
+
+    util::Clock clock;
+    clock.reset();
+    simulation::MassSpringSystem particleSystem;
+    if (options.loadPath.empty()) {
+        particleSystem.particleCountPerEdge = options.particleCountPerEdge;
+        particleSystem.deltaTime = options.deltaTime;
+        particleSystem.isSelfColliding = options.isSelfColliding;
+        particleSystem.setCubeCount(options.cubeCount);
+        for (const auto type : {simulation::Spring::SpringType::STRUCT, simulation::Spring::SpringType::SHEAR,
+                                simulation::Spring::SpringType::BENDING}) {
+            particleSystem.setSpringCoef(options.springCoef, type);
+            particleSystem.setDamperCoef(options.damperCoef, type);
+        }
+        particleSystem.setTerrain(options.isUsingSDFTerrain
+                                      ? simulation::TerrainFactory::CreateSDFTerrain(options.terrain)
+                                      : simulation::TerrainFactory::CreateTerrain(options.terrain));
+        particleSystem.setIntegrator(simulation::IntegratorFactory::CreateIntegrator(options.integrator));
+    } else {
+        try {
+            particleSystem.loadCheckpoint(options.loadPath);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+    particleSystem.isSimulating = true;
+    std::unique_ptr<util::TrajectoryWriter> trajectory;
+    std::vector<float> frame;
+    if (!options.trajectoryPath.empty()) {
+        util::TrajectoryInfo info;
+        info.cubeCount = particleSystem.getCubeCount();
+        info.particleCountPerEdge = particleSystem.particleCountPerEdge;
+        info.frameTime = options.frameSteps * particleSystem.deltaTime;
+        try {
+            trajectory = std::make_unique<util::TrajectoryWriter>(options.trajectoryPath, info);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        frame.resize(info.frameSize());
+    }
+    // the trajectory starts with the initial state, then takes every frameSteps-th step
+    const auto recordFrame = [&particleSystem, &trajectory, &frame] {
+        float* position = frame.data();
+        for (int cubeIdx = 0; cubeIdx < particleSystem.getCubeCount(); ++cubeIdx) {
+            const simulation::ParticleStore& particles = particleSystem.getCubePointer(cubeIdx)->getParticles();
+            for (int axis = 0; axis < 3; ++axis) {
+                const float* data = particles.positionData(axis);
+                for (int i = 0; i < particles.size(); ++i) position[3 * i + axis] = data[i];
+            }
+            position += 3 * particles.size();
+        }
+        trajectory->write(frame.data());
+    };
+    const double setupTime = clock.timeElapsed();
+
+    clock.reset();
+    try {
+        if (trajectory) recordFrame();
+        for (int step = 0; step < options.steps; ++step) {
+            particleSystem.simulationOneTimeStep();
+            if (trajectory && (step + 1) % options.frameSteps == 0) recordFrame();
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    const double simulationTime = clock.timeElapsed();
+    // flush the frames still being encoded
+    if (trajectory) {
+        try {
+            trajectory->finish();
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        trajectory.reset();
+    }
+
+    if (!options.savePath.empty()) {
+        try {
+            particleSystem.saveCheckpoint(options.savePath);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    const long long particleCount = static_cast<long long>(particleSystem.getCubeCount()) *
+                                    particleSystem.particleCountPerEdge * particleSystem.particleCountPerEdge *
+                                    particleSystem.particleCountPerEdge;
+    std::cout << std::left << std::setw(26) << "Threads"
+              << ": " << util::ThreadPool::getInstance().getThreadCount() << std::endl;
+    std::cout << std::left << std::setw(26) << "Particles"
+              << ": " << particleCount << std::endl;
+    std::cout << std::left << std::setw(26) << "Setup time"
+              << ": " << setupTime << " ms" << std::endl;
+    std::cout << std::left << std::setw(26) << "Simulation time"
+              << ": " << simulationTime << " ms for " << options.steps << " steps" << std::endl;
+    std::cout << std::left << std::setw(26) << "Time per step"
+              << ": " << simulationTime / options.steps << " ms" << std::endl;
+    std::cout << std::left << std::setw(26) << "Particle steps per second"
+              << ": " << particleCount * options.steps / (simulationTime / 1000.0) << std::endl;
+    float maxSpeed = 0.0f;
+    for (int cubeIdx = 0; cubeIdx < particleSystem.getCubeCount(); ++cubeIdx) {
+        const simulation::ParticleStore& particles = particleSystem.getCubePointer(cubeIdx)->getParticles();
+        for (int i = 0; i < particles.size(); ++i) maxSpeed = std::max(maxSpeed, particles.getVelocity(i).norm());
+    }
+    std::cout << std::left << std::setw(26) << "Max speed"
+              << ": " << maxSpeed << std::endl;
+    const bool isStable = particleSystem.checkStable();
+    std::cout << std::left << std::setw(26) << "Stable"
+              << ": " << (isStable ? "yes" : "no") << std::endl;
+    if (options.restSpeed > 0.0f) {
+        const bool isResting = maxSpeed < options.restSpeed;
+        std::cout << std::left << std::setw(26) << "At rest"
+                  << ": " << (isResting ? "yes" : "no") << std::endl;
+        if (!isResting) return EXIT_FAILURE;
+    }
+    return isStable ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -8,11 +8,17 @@ First step: Search TODO comments to find the methods that you need to implement.
     - src/simulation/terrain.cpp
 
 */
+#include <algorithm>
+#include <array>
 #include <cstdlib>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <chrono>
 #include <memory>
 #include <stdexcept>
+#include <utility>
+#include <vector>
 
 #include "Eigen/Core"
 #include "GLFW/glfw3.h"
@@ -40,6 +46,10 @@ int g_ScreenWidth = 1024, g_ScreenHeight = 768;
 gfx::Rigidbody* currentTerrainGraphics = nullptr;
 // Current terrain type
 auto currentTerrainType = simulation::TerrainType::Plane;
+// Whether the current terrain collides through its sampled signed distance field
+bool isUsingSDFTerrain = false;
+// Written by the save button of the simulation panel and read by its load button
+constexpr const char* checkpointPath = "checkpoint.bin";
 // Plane and tiltedplane share same vertices
 // Their difference is model matrix
 std::unique_ptr<gfx::Plane> g_Plane = nullptr;
@@ -47,8 +57,12 @@ std::unique_ptr<gfx::Plane> g_Plane = nullptr;
 // But they have different render behavior based on
 // gfx::Sphere::RenderMode::WIREFRAME or gfx::Sphere::RenderMode::FILLED
 std::unique_ptr<gfx::Sphere> g_Sphere = nullptr;
-// Soft body cube's graphic
-std::unique_ptr<gfx::SoftCube> g_cube = nullptr;
+// Heightfield terrain's graphic
+std::unique_ptr<gfx::Heightfield> g_Heightfield = nullptr;
+// Soft body cubes' graphics, one per simulated cube
+std::vector<std::unique_ptr<gfx::SoftCube>> g_cubes;
+// Dice textures shared by every cube
+std::array<std::shared_ptr<gfx::Texture>, 6> g_diceTextures;
 // Camera controlled by setting in camera panel
 gfx::Camera basicCamera;
 // Camera controlled by keyboard and mouse
@@ -59,6 +73,8 @@ gfx::CameraBase* currentCamera = &basicCamera;
 bool isUsingDebugCamera = false;
 // Switch for recording
 bool isRecording = false;
+// Output of the next recording
+auto recordingFormat = util::ExportFormat::Y4M;
 // Switch for render camera control panel
 bool isUsingCameraPanel = false;
 // Switch for render record control panel
@@ -69,11 +85,26 @@ bool isUsingSimulationPanel = false;
 bool isUsingDebugPanel = false;
 // for simulation
 simulation::MassSpringSystem particleSystem;
+// Steps particleSystem from then on. Only this thread writes the parameters of particleSystem, so reading them takes
+// no lock; writing them and touching anything else of the system goes through editSystem()
+std::unique_ptr<simulation::SimulationThread> g_simulation = nullptr;
+// The two newest snapshots of the simulation, the cubes are shown in between
+simulation::Snapshot g_previousSnapshot, g_latestSnapshot;
+// Step and interpolation factor of the positions shown
+long long shownStep = -1;
+float shownAlpha = 1.0f;
+// Show the cubes between the two newest snapshots rather than at the newest
+bool isInterpolating = true;
 // The value is based on moniter refresh rate to uniform simulation speed
 // It is calculated by ceil(480 / refresh rate)
+// The simulation thread takes this many steps per refresh period
 int simulationPerFrame = 0;
 // Test system stability
 bool isSystemStable = true;
+// particleSystem.isSimulating as of the last edit, a later snapshot of a system that blew up clears it
+bool isSystemSimulating = false;
+// Steps the simulation had taken at the last edit, snapshots up to it are older than isSystemSimulating
+long long editStep = 0;
 // For debugging
 double simulationTime = 0, dataUpdateTime = 0, shadowRenderTime = 0, sceneRenderTime = 0, uiRenderTime = 0,
        eventPollTime = 0, recordTime = 0;
@@ -83,6 +114,17 @@ bool isFPSLimited = true;
 std::unique_ptr<util::Exporter> g_Exporter = nullptr;
 // For simulationPerFrame before enter export mode
 int simulationPerFrameOld = 0;
+// Written while recording a trajectory and read back by its playback
+constexpr const char* trajectoryPath = "trajectory.bin";
+std::unique_ptr<util::TrajectoryWriter> g_trajectoryWriter = nullptr;
+// Replaces the simulation as the source of the cubes' positions while set
+std::unique_ptr<util::TrajectoryReader> g_trajectoryReader = nullptr;
+// Positions of every particle of every cube in one trajectory frame
+std::vector<float> g_trajectoryFrame;
+// Playback position, it advances one recorded frame per rendered frame unless paused
+int playbackFrame = 0;
+int shownPlaybackFrame = -1;
+bool isPlaybackPaused = false;
 }  // namespace
 
 /**
@@ -113,6 +155,47 @@ void debugCameraKeyboard(GLFWwindow* window, int key, int scancode, int action,
  * @param window The context to be destroyed
  */
 void shutdown();
+/**
+ * @brief Run edit on particleSystem while the simulation thread stands aside,
+ * then take a copy of the state the panels show.
+ */
+void editSystem(const std::function<void()>& edit);
+/**
+ * @brief Rebuild the graphics of every cube, needed whenever the cube count
+ * changes.
+ */
+void createSoftCubes();
+/**
+ * @brief Point currentTerrainGraphics at the graphics of terrain type.
+ */
+void selectTerrainGraphics(simulation::TerrainType type);
+/**
+ * @brief Restore the simulation from checkpointPath and rebuild the graphics
+ * to match it.
+ */
+void loadCheckpoint();
+/**
+ * @brief Take the newest snapshot of the simulation and show the cubes at
+ * it, or between it and the one before.
+ */
+void showSnapshot();
+/**
+ * @brief Append the newest snapshot of the simulation to the recorded
+ * trajectory.
+ */
+void recordTrajectoryFrame();
+/**
+ * @brief Finish the recorded trajectory, reporting a failure to write it.
+ */
+void stopTrajectoryRecording();
+/**
+ * @brief Open trajectoryPath for playback and rebuild the cubes to match it.
+ */
+void startPlayback();
+/**
+ * @brief Show the cubes at playbackFrame, then advance it.
+ */
+void showPlaybackFrame();
 /**
  * @brief Dear-ImGui main control panel
  *
@@ -157,8 +240,6 @@ int main() {
     gfx::Program shadowProgram;
     // Texture for shadow mapping
     gfx::ShadowMapTexture shadow(shadowTextureSize);
-    // Handle softbody graphics
-    g_cube = std::make_unique<gfx::SoftCube>(particleSystem.getCubePointer(0));
     // The skybox
     gfx::SkyBox skybox;
     // Load data from assets
@@ -189,11 +270,13 @@ int main() {
         shadowProgram.linkShader(shadowVertexShader, shadowFragmentShader);
         simpleRenderProgram.linkShader(particleVertexShader, particleFragmentShader);
         skyboxRenderProgram.linkShader(skyboxVertexShader, skyboxFragmentShader);
-        // Ownership is passed to gfx::SoftCube, so these shared pointers
+        // Ownership is shared with gfx::SoftCube, so these shared pointers
         // can be destroyed safely.
-        g_cube->setTextures({dice1, dice2, dice3, dice4, dice5, dice6});
+        g_diceTextures = {dice1, dice2, dice3, dice4, dice5, dice6};
         skybox.setTexture(sky);
     }
+    // Handle softbody graphics
+    createSoftCubes();
     // Setup light, uniforms are persisted.
     {
         Eigen::Vector3f lightPosition(11.1f, 24.9f, -14.8f);
@@ -218,20 +301,18 @@ int main() {
         if (isUsingDebugCamera) debugCamera.moveCamera(window);
         // Update numbers smoothly.
         eventPollTime = 0.5 * eventPollTime + 0.5 * clock.timeElapsed();
-        // Simulation
-        for (int i = 0; i < simulationPerFrame; i++) particleSystem.simulationOneTimeStep();
-        // Stability checking
-        if (particleSystem.isSimulating) {
-            if (particleSystem.checkStable()) {
-                isSystemStable = true;
-            } else {
-                isSystemStable = false;
-                particleSystem.isSimulating = false;
-            }
-        }
+        // Simulation runs on its own thread, except during recordings whose frames must be exactly one batch apart
+        const bool isFrameLocked = isRecording || g_trajectoryWriter != nullptr;
+        g_simulation->setStepsPerBatch(simulationPerFrame);
+        g_simulation->setFrameLocked(isFrameLocked);
+        if (isFrameLocked) g_simulation->stepBatch();
         simulationTime = 0.5 * simulationTime + 0.5 * clock.timeElapsed();
-        // Update position and normal only when simulating
-        if (particleSystem.isSimulating) g_cube->update();
+        // Update position and normal from the simulation or the playback
+        if (g_trajectoryReader) {
+            showPlaybackFrame();
+        } else {
+            showSnapshot();
+        }
         dataUpdateTime = 0.5 * dataUpdateTime + 0.5 * clock.timeElapsed();
         // 1. Render shadow to texture
         glViewport(0, 0, shadow.getShadowSize(), shadow.getShadowSize());
@@ -242,19 +323,25 @@ int main() {
         // Rendor terrain's shadow
         currentTerrainGraphics->render(&shadowProgram);
         // Rendor cube's shadow
-        if (particleSystem.isDrawingCube)
-            g_cube->renderCube(&shadowProgram);
-        else
-            g_cube->renderPoints(&shadowProgram);
+        for (auto& softCube : g_cubes) {
+            if (particleSystem.isDrawingCube)
+                softCube->renderCube(&shadowProgram);
+            else
+                softCube->renderPoints(&shadowProgram);
+        }
 
         if (particleSystem.isDrawingStruct) {
-            g_cube->renderLines(&shadowProgram, simulation::Spring::SpringType::STRUCT);
+            for (auto& softCube : g_cubes) {
+                softCube->renderLines(&shadowProgram, simulation::Spring::SpringType::STRUCT);
+            }
         }
         if (particleSystem.isDrawingShear) {
-            g_cube->renderLines(&shadowProgram, simulation::Spring::SpringType::SHEAR);
+            for (auto& softCube : g_cubes) softCube->renderLines(&shadowProgram, simulation::Spring::SpringType::SHEAR);
         }
         if (particleSystem.isDrawingBending) {
-            g_cube->renderLines(&shadowProgram, simulation::Spring::SpringType::BENDING);
+            for (auto& softCube : g_cubes) {
+                softCube->renderLines(&shadowProgram, simulation::Spring::SpringType::BENDING);
+            }
         }
         shadow.unbindFrameBuffer();
         glCullFace(GL_BACK);
@@ -266,16 +353,22 @@ int main() {
         simpleRenderProgram.setUniform("VP", currentCamera->viewWithProjection());
 
         if (!particleSystem.isDrawingCube) {
-            g_cube->renderPoints(&simpleRenderProgram);
+            for (auto& softCube : g_cubes) softCube->renderPoints(&simpleRenderProgram);
         }
         if (particleSystem.isDrawingStruct) {
-            g_cube->renderLines(&simpleRenderProgram, simulation::Spring::SpringType::STRUCT);
+            for (auto& softCube : g_cubes) {
+                softCube->renderLines(&simpleRenderProgram, simulation::Spring::SpringType::STRUCT);
+            }
         }
         if (particleSystem.isDrawingShear) {
-            g_cube->renderLines(&simpleRenderProgram, simulation::Spring::SpringType::SHEAR);
+            for (auto& softCube : g_cubes) {
+                softCube->renderLines(&simpleRenderProgram, simulation::Spring::SpringType::SHEAR);
+            }
         }
         if (particleSystem.isDrawingBending) {
-            g_cube->renderLines(&simpleRenderProgram, simulation::Spring::SpringType::BENDING);
+            for (auto& softCube : g_cubes) {
+                softCube->renderLines(&simpleRenderProgram, simulation::Spring::SpringType::BENDING);
+            }
         }
         // 2b. Render scene (cube / terrain)
         renderProgram.use();
@@ -289,7 +382,7 @@ int main() {
                 glEnable(GL_POLYGON_OFFSET_FILL);
                 glPolygonOffset(1.0, 1.0f);
             }
-            g_cube->renderCube(&renderProgram);
+            for (auto& softCube : g_cubes) softCube->renderCube(&renderProgram);
             if (cubeWithLine) {
                 glDisable(GL_POLYGON_OFFSET_FILL);
             }
@@ -306,14 +399,7 @@ int main() {
         renderUI(window);
         uiRenderTime = 0.5 * uiRenderTime + 0.5 * clock.timeElapsed();
         // 5. Output screenshots if needed
-        if (isRecording) {
-            g_Exporter->outputScreenShot();
-            if (util::Writer::getPictureCounter() >= 999) {
-                // Restore old simulation per frame setting.
-                simulationPerFrame = simulationPerFrameOld;
-                isRecording = false;
-            }
-        }
+        if (isRecording) g_Exporter->outputScreenShot();
         recordTime = 0.5 * recordTime + 0.5 * clock.timeElapsed();
         glfwSwapBuffers(window);
     }
@@ -382,6 +468,8 @@ GLFWwindow* initialize() {
               << ": " << maxTextureSize << " * " << maxTextureSize << std::endl;
     std::cout << std::left << std::setw(26) << "Shadow texture size"
               << ": " << shadowTextureSize << " * " << shadowTextureSize << std::endl;
+    std::cout << std::left << std::setw(26) << "Thread pool size"
+              << ": " << util::ThreadPool::getInstance().getThreadCount() << std::endl;
     // Setup exporter
     g_Exporter = std::make_unique<util::Exporter>();
     // Setup Opengl
@@ -407,6 +495,13 @@ GLFWwindow* initialize() {
     g_Plane->setTexture(wood);
     g_Sphere = std::make_unique<gfx::Sphere>();
     g_Sphere->setTexture(wood);
+    {
+        // the mesh copies what it needs, the terrain only lives for the construction
+        const auto heightfield = simulation::TerrainFactory::CreateTerrain(simulation::TerrainType::Heightfield);
+        g_Heightfield =
+            std::make_unique<gfx::Heightfield>(static_cast<const simulation::HeightfieldTerrain&>(*heightfield));
+        g_Heightfield->setTexture(wood);
+    }
     // Physics engine
     auto terrain = simulation::TerrainFactory::CreateTerrain(simulation::TerrainType::Plane);
     auto integrator = simulation::IntegratorFactory::CreateIntegrator(simulation::IntegratorType::ExplicitEuler);
@@ -414,6 +509,10 @@ GLFWwindow* initialize() {
     currentTerrainGraphics = g_Plane.get();
     currentTerrainGraphics->setModelMatrix(terrain->getModelMatrix());
     particleSystem.setTerrain(std::move(terrain));
+    isSystemSimulating = particleSystem.isSimulating;
+    g_simulation = std::make_unique<simulation::SimulationThread>(particleSystem);
+    g_simulation->setStepsPerBatch(simulationPerFrame);
+    g_simulation->setBatchPeriod(1.0 / vidMode->refreshRate);
     return window;
 }
 
@@ -434,14 +533,185 @@ void debugCameraKeyboard(GLFWwindow* window, int key, int scancode, int action,
 }
 
 void shutdown() {
+    // Stop stepping before anything the simulation thread uses is destroyed
+    g_simulation.reset();
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
     // Destructor should be called before glfwTerminate()
     g_Plane.reset();
     g_Sphere.reset();
-    g_cube.reset();
+    g_Heightfield.reset();
+    g_cubes.clear();
+    g_diceTextures = {};
     g_Exporter.reset();
+    // Flush the trajectory being recorded
+    stopTrajectoryRecording();
+}
+
+void editSystem(const std::function<void()>& edit) {
+    simulation::SimulationThread::EditLock lock(*g_simulation);
+    edit();
+    isSystemSimulating = particleSystem.isSimulating;
+    editStep = g_simulation->getStepCount();
+}
+
+void createSoftCubes() {
+    g_cubes.clear();
+    for (int cubeIdx = 0; cubeIdx < particleSystem.getCubeCount(); cubeIdx++) {
+        g_cubes.push_back(std::make_unique<gfx::SoftCube>(particleSystem.getCubePointer(cubeIdx)));
+        g_cubes.back()->setTextures(g_diceTextures);
+    }
+}
+
+void selectTerrainGraphics(simulation::TerrainType type) {
+    using simulation::TerrainType;
+    if (type == TerrainType::Plane || type == TerrainType::TiltedPlane) {
+        currentTerrainGraphics = g_Plane.get();
+    } else if (type == TerrainType::Sphere || type == TerrainType::Bowl) {
+        g_Sphere->setRenderMode(type == TerrainType::Sphere ? gfx::Sphere::RenderMode::FILLED
+                                                             : gfx::Sphere::RenderMode::WIREFRAME);
+        currentTerrainGraphics = g_Sphere.get();
+    } else if (type == TerrainType::Heightfield) {
+        currentTerrainGraphics = g_Heightfield.get();
+    }
+}
+
+void loadCheckpoint() {
+    try {
+        editSystem([] {
+            particleSystem.loadCheckpoint(checkpointPath);
+            createSoftCubes();
+            // "Start" resets the cubes, so resume right away
+            particleSystem.isSimulating = true;
+        });
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return;
+    }
+    simulation::Terrain* terrain = particleSystem.getTerrain();
+    if (terrain != nullptr) {
+        isUsingSDFTerrain = terrain->getType() == simulation::TerrainType::SDF;
+        currentTerrainType =
+            isUsingSDFTerrain ? static_cast<simulation::SDFTerrain*>(terrain)->getSourceType() : terrain->getType();
+        selectTerrainGraphics(currentTerrainType);
+        currentTerrainGraphics->setModelMatrix(terrain->getModelMatrix());
+    }
+    isSystemStable = true;
+}
+
+void showSnapshot() {
+    if (g_simulation->updateSnapshot()) {
+        std::swap(g_previousSnapshot, g_latestSnapshot);
+        g_latestSnapshot = g_simulation->getSnapshot();
+        isSystemStable = g_latestSnapshot.isStable;
+        // the simulation thread stops a system that blew up
+        if (!isSystemStable && g_latestSnapshot.step > editStep) isSystemSimulating = false;
+        if (g_trajectoryWriter) recordTrajectoryFrame();
+    }
+    const simulation::Snapshot& latest = g_latestSnapshot;
+    const simulation::Snapshot& previous = g_previousSnapshot;
+    // A snapshot taken before the cubes were rebuilt does not fit them
+    if (latest.cubeCount != static_cast<int>(g_cubes.size()) ||
+        latest.particleCountPerEdge != particleSystem.particleCountPerEdge) {
+        return;
+    }
+    // Trail the newest snapshot by one snapshot period, frames of a recording show the snapshots as they are
+    float alpha = 1.0f;
+    if (isInterpolating && !isRecording && previous.positions.size() == latest.positions.size() &&
+        previous.step < latest.step && previous.time < latest.time) {
+        const std::chrono::duration<float> sinceLatest = std::chrono::steady_clock::now() - latest.time;
+        const std::chrono::duration<float> period = latest.time - previous.time;
+        alpha = std::min(sinceLatest / period, 1.0f);
+    }
+    if (latest.step == shownStep && alpha == shownAlpha) return;
+    const size_t cubeSize = latest.positions.size() / g_cubes.size();
+    for (size_t cubeIdx = 0; cubeIdx < g_cubes.size(); cubeIdx++) {
+        const float* next = latest.positions.data() + cubeIdx * cubeSize;
+        if (alpha < 1.0f) {
+            g_cubes[cubeIdx]->update(previous.positions.data() + cubeIdx * cubeSize, next, alpha);
+        } else {
+            g_cubes[cubeIdx]->update(next);
+        }
+    }
+    shownStep = latest.step;
+    shownAlpha = alpha;
+}
+
+void recordTrajectoryFrame() {
+    const util::TrajectoryInfo& info = g_trajectoryWriter->getInfo();
+    if (info.cubeCount != g_latestSnapshot.cubeCount ||
+        info.particleCountPerEdge != g_latestSnapshot.particleCountPerEdge) {
+        std::cerr << "Cubes changed, trajectory recording stopped" << std::endl;
+        stopTrajectoryRecording();
+        return;
+    }
+    try {
+        // a snapshot has the layout of a trajectory frame
+        g_trajectoryWriter->write(g_latestSnapshot.positions.data());
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        g_trajectoryWriter.reset();
+    }
+}
+
+void stopTrajectoryRecording() {
+    if (g_trajectoryWriter == nullptr) return;
+    try {
+        g_trajectoryWriter->finish();
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+    }
+    g_trajectoryWriter.reset();
+}
+
+void startPlayback() {
+    // Finish the file first if it is still being recorded
+    stopTrajectoryRecording();
+    try {
+        g_trajectoryReader = std::make_unique<util::TrajectoryReader>(trajectoryPath);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return;
+    }
+    if (g_trajectoryReader->getFrameCount() == 0) {
+        std::cerr << trajectoryPath << " has no frames" << std::endl;
+        g_trajectoryReader.reset();
+        return;
+    }
+    const util::TrajectoryInfo& info = g_trajectoryReader->getInfo();
+    editSystem([&info] {
+        particleSystem.isSimulating = false;
+        if (info.cubeCount != particleSystem.getCubeCount() ||
+            info.particleCountPerEdge != particleSystem.particleCountPerEdge) {
+            particleSystem.particleCountPerEdge = info.particleCountPerEdge;
+            particleSystem.setCubeCount(info.cubeCount);
+            createSoftCubes();
+        }
+    });
+    g_trajectoryFrame.resize(info.frameSize());
+    playbackFrame = 0;
+    shownPlaybackFrame = -1;
+    isPlaybackPaused = false;
+}
+
+void showPlaybackFrame() {
+    if (playbackFrame != shownPlaybackFrame) {
+        try {
+            g_trajectoryReader->read(playbackFrame, g_trajectoryFrame.data());
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            g_trajectoryReader.reset();
+            return;
+        }
+        const size_t cubeSize = g_trajectoryFrame.size() / g_cubes.size();
+        for (size_t cubeIdx = 0; cubeIdx < g_cubes.size(); cubeIdx++) {
+            g_cubes[cubeIdx]->update(g_trajectoryFrame.data() + cubeIdx * cubeSize);
+        }
+        shownPlaybackFrame = playbackFrame;
+    }
+    // Loop back to the first frame after the last one
+    if (!isPlaybackPaused) playbackFrame = (playbackFrame + 1) % g_trajectoryReader->getFrameCount();
 }
 
 void mainPanel() {
@@ -476,31 +746,34 @@ void mainPanel() {
         if (ImGui::Button("Plane") && currentTerrainType != TerrainType::Plane) {
             currentTerrainType = TerrainType::Plane;
             terrainChanged = true;
-            currentTerrainGraphics = g_Plane.get();
         }
         ImGui::SameLine();
         if (ImGui::Button("Sphere") && currentTerrainType != TerrainType::Sphere) {
             currentTerrainType = TerrainType::Sphere;
             terrainChanged = true;
-            g_Sphere->setRenderMode(gfx::Sphere::RenderMode::FILLED);
-            currentTerrainGraphics = g_Sphere.get();
         }
         if (ImGui::Button("Bowl") && currentTerrainType != TerrainType::Bowl) {
             currentTerrainType = TerrainType::Bowl;
             terrainChanged = true;
-            g_Sphere->setRenderMode(gfx::Sphere::RenderMode::WIREFRAME);
-            currentTerrainGraphics = g_Sphere.get();
         }
         ImGui::SameLine();
         if (ImGui::Button("TiltedPlane") && currentTerrainType != TerrainType::TiltedPlane) {
             currentTerrainType = TerrainType::TiltedPlane;
             terrainChanged = true;
-            currentTerrainGraphics = g_Plane.get();
+        }
+        if (ImGui::Button("Heightfield") && currentTerrainType != TerrainType::Heightfield) {
+            currentTerrainType = TerrainType::Heightfield;
+            terrainChanged = true;
+        }
+        if (ImGui::Checkbox("Sampled SDF", &isUsingSDFTerrain)) {
+            terrainChanged = true;
         }
         if (terrainChanged) {
-            auto terrain = simulation::TerrainFactory::CreateTerrain(currentTerrainType);
+            selectTerrainGraphics(currentTerrainType);
+            auto terrain = isUsingSDFTerrain ? simulation::TerrainFactory::CreateSDFTerrain(currentTerrainType)
+                                             : simulation::TerrainFactory::CreateTerrain(currentTerrainType);
             currentTerrainGraphics->setModelMatrix(terrain->getModelMatrix());
-            particleSystem.setTerrain(std::move(terrain));
+            editSystem([&terrain] { particleSystem.setTerrain(std::move(terrain)); });
         }
     }
     ImGui::End();
@@ -547,23 +820,68 @@ void cameraPanel(GLFWwindow* window) {
 
 void recordingPanel() {
     // Recording Control
-    ImGui::SetNextWindowSize(ImVec2(220.0f, 80.0f), ImGuiCond_Once);
+    ImGui::SetNextWindowSize(ImVec2(220.0f, 170.0f), ImGuiCond_Once);
     ImGui::SetNextWindowCollapsed(0, ImGuiCond_Once);
     ImGui::SetNextWindowPos(ImVec2(60.0f, 280.0f), ImGuiCond_Once);
     ImGui::SetNextWindowBgAlpha(0.2f);
     if (ImGui::Begin("Recording Control Panel", &isUsingRecordingPanel)) {
         ImGui::Text("Currently %srecording...", isRecording ? "" : "not ");
+        if (!isRecording) {
+            if (ImGui::RadioButton("Y4M video", recordingFormat == util::ExportFormat::Y4M)) {
+                recordingFormat = util::ExportFormat::Y4M;
+            }
+            ImGui::SameLine();
+            if (ImGui::RadioButton("JPEG", recordingFormat == util::ExportFormat::JPEG)) {
+                recordingFormat = util::ExportFormat::JPEG;
+            }
+        }
         const char* const recordingText = isRecording ? "Stop Recording" : "Start Recording";
         if (ImGui::Button(recordingText)) {
             if (isRecording) {
+                g_Exporter->stopRecording();
                 simulationPerFrame = simulationPerFrameOld;
+                isRecording = false;
+            } else {
+                try {
+                    // Matches the frame rate of utility/gen_video.bat
+                    g_Exporter->startRecording(recordingFormat, 60);
+                    simulationPerFrameOld = simulationPerFrame;
+                    simulationPerFrame = 5;
+                    isRecording = true;
+                } catch (const std::exception& e) {
+                    std::cerr << e.what() << std::endl;
+                }
+            }
+        }
+        // Trajectory of the simulation, one frame per rendered frame
+        if (ImGui::Button(g_trajectoryWriter ? "Stop Trajectory" : "Record Trajectory")) {
+            if (g_trajectoryWriter) {
+                stopTrajectoryRecording();
+            } else {
+                g_trajectoryReader.reset();
+                util::TrajectoryInfo info;
+                info.cubeCount = particleSystem.getCubeCount();
+                info.particleCountPerEdge = particleSystem.particleCountPerEdge;
+                info.frameTime = simulationPerFrame * particleSystem.deltaTime;
+                try {
+                    g_trajectoryWriter = std::make_unique<util::TrajectoryWriter>(trajectoryPath, info);
+                } catch (const std::exception& e) {
+                    std::cerr << e.what() << std::endl;
+                }
+            }
+        }
+        if (g_trajectoryWriter) ImGui::Text("Recorded %d frames", g_trajectoryWriter->getFrameCount());
+        if (ImGui::Button(g_trajectoryReader ? "Stop Playback" : "Play Trajectory")) {
+            if (g_trajectoryReader) {
+                g_trajectoryReader.reset();
             } else {
-                simulationPerFrameOld = simulationPerFrame;
-                simulationPerFrame = 5;
+                startPlayback();
             }
-            // Reset filename counter to 0
-            util::Writer::resetPictureCounter();
-            isRecording ^= true;
+        }
+        if (g_trajectoryReader) {
+            ImGui::SameLine();
+            if (ImGui::Button(isPlaybackPaused ? "Resume" : "Pause")) isPlaybackPaused ^= true;
+            ImGui::SliderInt("Frame", &playbackFrame, 0, g_trajectoryReader->getFrameCount() - 1);
         }
     }
     ImGui::End();
@@ -576,76 +894,143 @@ void simulationPanel() {
     ImGui::SetNextWindowPos(ImVec2(300.0f, 280.0f), ImGuiCond_Once);
     ImGui::SetNextWindowBgAlpha(0.2f);
     if (ImGui::Begin("Simulation Control Panel", &isUsingSimulationPanel)) {
-        if (ImGui::Button(particleSystem.isSimulating ? "Stop" : "Start")) {
-            particleSystem.reset();
-            particleSystem.isSimulating ^= true;
+        if (ImGui::Button(isSystemSimulating ? "Stop" : "Start")) {
+            g_trajectoryReader.reset();
+            editSystem([] {
+                particleSystem.reset();
+                particleSystem.isSimulating = !isSystemSimulating;
+            });
         }
+        ImGui::SameLine();
+        if (ImGui::Button("Save Checkpoint")) {
+            try {
+                editSystem([] { particleSystem.saveCheckpoint(checkpointPath); });
+            } catch (const std::exception& e) {
+                std::cerr << e.what() << std::endl;
+            }
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Load Checkpoint")) loadCheckpoint();
         // Render checkbox can be edited while simulating
         ImGui::Checkbox("Draw Cube", &particleSystem.isDrawingCube);
         ImGui::Checkbox("Draw Struct", &particleSystem.isDrawingStruct);
         ImGui::Checkbox("Draw Shear", &particleSystem.isDrawingShear);
         ImGui::Checkbox("Draw Bending", &particleSystem.isDrawingBending);
+        // The widgets below edit copies, the simulation thread reads the parameters while it steps
+        bool isSelfColliding = particleSystem.isSelfColliding;
+        if (ImGui::Checkbox("Self Collision", &isSelfColliding)) {
+            editSystem([isSelfColliding] { particleSystem.isSelfColliding = isSelfColliding; });
+        }
+        ImGui::Checkbox("Interpolate Frames", &isInterpolating);
         // Only allow simulation parameter editing when system is not
         // simulating.
-        if (particleSystem.isSimulating) {
+        if (isSystemSimulating) {
             ImGui::Text("Stop simulation to edit parameters...");
         } else {
             ImGui::Text("Integration Method = %d", static_cast<int>(particleSystem.integratorType));
             using simulation::IntegratorFactory;
             using simulation::IntegratorType;
-            if (ImGui::Button("EXPLICIT_EULER")) {
-                particleSystem.setIntegrator(IntegratorFactory::CreateIntegrator(IntegratorType::ExplicitEuler));
-            }
+            const auto selectIntegrator = [](IntegratorType type) {
+                editSystem([type] { particleSystem.setIntegrator(IntegratorFactory::CreateIntegrator(type)); });
+            };
+            if (ImGui::Button("EXPLICIT_EULER")) selectIntegrator(IntegratorType::ExplicitEuler);
             ImGui::SameLine();
-            if (ImGui::Button("IMPLICIT_EULER")) {
-                particleSystem.setIntegrator(IntegratorFactory::CreateIntegrator(IntegratorType::ImplicitEuler));
-            }
-            if (ImGui::Button("MIDPOINT_EULER")) {
-                particleSystem.setIntegrator(IntegratorFactory::CreateIntegrator(IntegratorType::MidpointEuler));
-            }
+            if (ImGui::Button("IMPLICIT_EULER")) selectIntegrator(IntegratorType::ImplicitEuler);
+            if (ImGui::Button("MIDPOINT_EULER")) selectIntegrator(IntegratorType::MidpointEuler);
             ImGui::SameLine();
-            if (ImGui::Button("RUNGE_KUTTA")) {
-                particleSystem.setIntegrator(IntegratorFactory::CreateIntegrator(IntegratorType::RungeKuttaFourth));
-            }
+            if (ImGui::Button("RUNGE_KUTTA")) selectIntegrator(IntegratorType::RungeKuttaFourth);
+            if (ImGui::Button("BACKWARD_EULER")) selectIntegrator(IntegratorType::BackwardEuler);
+            if (ImGui::Button("PROJECTIVE_DYNAMICS")) selectIntegrator(IntegratorType::ProjectiveDynamics);
+            if (ImGui::Button("XPBD")) selectIntegrator(IntegratorType::XPBD);
+            if (ImGui::Button("DORMAND_PRINCE")) selectIntegrator(IntegratorType::DormandPrince);
+            ImGui::Text("Force Mode = %d", static_cast<int>(particleSystem.forceMode));
+            using simulation::ForceMode;
+            const auto selectForceMode = [](ForceMode mode) {
+                editSystem([mode] { particleSystem.setForceMode(mode); });
+            };
+            if (ImGui::Button("SCATTER")) selectForceMode(ForceMode::Scatter);
+            ImGui::SameLine();
+            if (ImGui::Button("COLORED")) selectForceMode(ForceMode::Colored);
+            ImGui::SameLine();
+            if (ImGui::Button("GATHER")) selectForceMode(ForceMode::Gather);
             if (ImGui::InputInt("Simulation Per Frame", &simulationPerFrame)) {
                 simulationPerFrame = std::max(simulationPerFrame, 1);
             }
-            if (ImGui::InputFloat("Delta Time", &particleSystem.deltaTime, 0.0001f, 0.0005f, "%.4f")) {
-                particleSystem.deltaTime = std::max(particleSystem.deltaTime, 0.0f);
+            float deltaTime = particleSystem.deltaTime;
+            if (ImGui::InputFloat("Delta Time", &deltaTime, 0.0001f, 0.0005f, "%.4f")) {
+                editSystem([deltaTime] { particleSystem.deltaTime = std::max(deltaTime, 0.0f); });
             }
-            if (ImGui::InputFloat("Spring Coef", &particleSystem.springCoefStruct, 10.0f, 1.0f)) {
-                particleSystem.springCoefStruct = std::max(particleSystem.springCoefStruct, 0.0f);
-                particleSystem.setSpringCoef(particleSystem.springCoefStruct, simulation::Spring::SpringType::STRUCT);
-                particleSystem.setSpringCoef(particleSystem.springCoefStruct, simulation::Spring::SpringType::SHEAR);
-                particleSystem.setSpringCoef(particleSystem.springCoefStruct, simulation::Spring::SpringType::BENDING);
+            float springCoef = particleSystem.springCoefStruct;
+            if (ImGui::InputFloat("Spring Coef", &springCoef, 10.0f, 1.0f)) {
+                editSystem([springCoef] {
+                    particleSystem.springCoefStruct = std::max(springCoef, 0.0f);
+                    particleSystem.setSpringCoef(particleSystem.springCoefStruct,
+                                                 simulation::Spring::SpringType::STRUCT);
+                    particleSystem.setSpringCoef(particleSystem.springCoefStruct,
+                                                 simulation::Spring::SpringType::SHEAR);
+                    particleSystem.setSpringCoef(particleSystem.springCoefStruct,
+                                                 simulation::Spring::SpringType::BENDING);
+                });
             }
-            if (ImGui::InputFloat("Damper Coef", &particleSystem.damperCoefStruct, 10.0, 1.0)) {
-                particleSystem.damperCoefStruct = std::max(particleSystem.damperCoefStruct, 0.0f);
-                particleSystem.setDamperCoef(particleSystem.damperCoefStruct, simulation::Spring::SpringType::STRUCT);
-                particleSystem.setDamperCoef(particleSystem.damperCoefStruct, simulation::Spring::SpringType::SHEAR);
-                particleSystem.setDamperCoef(particleSystem.damperCoefStruct, simulation::Spring::SpringType::BENDING);
+            float damperCoef = particleSystem.damperCoefStruct;
+            if (ImGui::InputFloat("Damper Coef", &damperCoef, 10.0, 1.0)) {
+                editSystem([damperCoef] {
+                    particleSystem.damperCoefStruct = std::max(damperCoef, 0.0f);
+                    particleSystem.setDamperCoef(particleSystem.damperCoefStruct,
+                                                 simulation::Spring::SpringType::STRUCT);
+                    particleSystem.setDamperCoef(particleSystem.damperCoefStruct,
+                                                 simulation::Spring::SpringType::SHEAR);
+                    particleSystem.setDamperCoef(particleSystem.damperCoefStruct,
+                                                 simulation::Spring::SpringType::BENDING);
+                });
             }
-            if (ImGui::InputFloat("Cube Y Offset", &particleSystem.position[1], 0.3f, 0.05f)) {
-                particleSystem.position[1] = std::max(particleSystem.position[1], 1.0f);
+            float cubeYOffset = particleSystem.position[1];
+            if (ImGui::InputFloat("Cube Y Offset", &cubeYOffset, 0.3f, 0.05f)) {
+                editSystem([cubeYOffset] { particleSystem.position[1] = std::max(cubeYOffset, 1.0f); });
+            }
+            float rotation = particleSystem.rotation;
+            if (ImGui::InputFloat("Cube Rotation", &rotation, 0.3f, 0.05f)) {
+                editSystem([rotation] { particleSystem.rotation = rotation; });
+            }
+            float contactStiffness = particleSystem.contactStiffness;
+            if (ImGui::InputFloat("Contact Stiffness", &contactStiffness, 10.0f, 1.0f)) {
+                editSystem([contactStiffness] { particleSystem.contactStiffness = std::max(contactStiffness, 0.0f); });
+            }
+            float contactDamping = particleSystem.contactDamping;
+            if (ImGui::InputFloat("Contact Damping", &contactDamping, 10.0f, 1.0f)) {
+                editSystem([contactDamping] { particleSystem.contactDamping = std::max(contactDamping, 0.0f); });
+            }
+            float contactFriction = particleSystem.contactFriction;
+            if (ImGui::InputFloat("Contact Friction", &contactFriction, 0.1f, 0.01f)) {
+                editSystem([contactFriction] { particleSystem.contactFriction = std::max(contactFriction, 0.0f); });
+            }
+            int cubeCount = particleSystem.getCubeCount();
+            if (ImGui::InputInt("Cube Count", &cubeCount)) {
+                editSystem([cubeCount] {
+                    particleSystem.setCubeCount(std::max(cubeCount, 1));
+                    createSoftCubes();
+                });
             }
-            ImGui::InputFloat("Cube Rotation", &particleSystem.rotation, 0.3f, 0.05f);
         }
         if (ImGui::Button("Reset cube")) {
-            particleSystem.reset();
-            g_cube->update();
+            editSystem([] {
+                particleSystem.reset();
+                for (auto& softCube : g_cubes) softCube->update();
+            });
         }
     }
     ImGui::End();
 }
 
 void debugPanel() {
-    ImGui::SetNextWindowSize(ImVec2(220.0f, 230.0f), ImGuiCond_Once);
+    ImGui::SetNextWindowSize(ImVec2(220.0f, 320.0f), ImGuiCond_Once);
     ImGui::SetNextWindowCollapsed(0, ImGuiCond_Once);
     ImGui::SetNextWindowPos(ImVec2(60.0f, 370.0f), ImGuiCond_Once);
     ImGui::SetNextWindowBgAlpha(0.2f);
     if (ImGui::Begin("Debug Panel", &isUsingDebugPanel)) {
         ImGui::Text("Poll events    : %.3lf ms", eventPollTime);
         ImGui::Text("Simulation     : %.3lf ms", simulationTime);
+        ImGui::Text("Sim. thread    : %.3lf ms", g_simulation->getBatchTime());
         ImGui::Text("Update data    : %.3lf ms", dataUpdateTime);
         ImGui::Text("Render shadows : %.3lf ms", shadowRenderTime);
         ImGui::Text("Render scene   : %.3lf ms", sceneRenderTime);
@@ -656,6 +1041,14 @@ void debugPanel() {
                            uiRenderTime + recordTime;
         ImGui::Text("Total          : %.3lf ms", totalTime);
         ImGui::Text("Current FPS    : %.1lf FPS", 1000.0 / totalTime);
+        ImGui::Text("-------------------------");
+        // the encoders fall behind when the queue stays full and frames get dropped
+        const util::FrameQueue::Statistics exportStatistics = g_Exporter->getStatistics();
+        ImGui::Text("Export queue   : %d / %d", exportStatistics.queued, exportStatistics.capacity);
+        ImGui::Text("Frames encoded : %lld", exportStatistics.encoded);
+        ImGui::Text("Frames dropped : %lld", exportStatistics.dropped);
+        ImGui::Text("Encode latency : %.1lf ms", exportStatistics.averageLatency);
+        ImGui::Text("Worst latency  : %.1lf ms", exportStatistics.maxLatency);
         if (ImGui::Button("Vsync")) {
             isFPSLimited ^= true;
             glfwSwapInterval(isFPSLimited);
@@ -91,6 +91,63 @@ void Plane::render(Program* shaderProgram) {
     glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
 }
 
+Heightfield::Heightfield(const simulation::HeightfieldTerrain& terrain) {
+    const int width = terrain.getWidth();
+    const int depth = terrain.getDepth();
+    // world size of the unit square, normals are stored scaled by it so that invtransmodel restores them
+    const Eigen::Vector4f corner = terrain.getModelMatrix() * Eigen::Vector4f(-0.5f, 0.0f, -0.5f, 1.0f);
+    const Eigen::Vector4f size = terrain.getModelMatrix() * Eigen::Vector4f(1.0f, 0.0f, 1.0f, 0.0f);
+    vertices.reserve(8 * width * depth);
+    for (int j = 0; j < depth; ++j) {
+        for (int i = 0; i < width; ++i) {
+            const float u = static_cast<float>(i) / (width - 1);
+            const float v = static_cast<float>(j) / (depth - 1);
+            Eigen::Vector3f normal;
+            terrain.sample(corner[0] + u * size[0], corner[2] + v * size[2], normal);
+            normal = normal.cwiseProduct(Eigen::Vector3f(size[0], 1.0f, size[2])).normalized();
+            vertices.insert(vertices.end(),
+                            {u - 0.5f, terrain.getNodeHeight(i, j), v - 0.5f, normal[0], normal[1], normal[2], u, v});
+        }
+    }
+
+    indices.reserve(6 * (width - 1) * (depth - 1));
+    for (int j = 0; j < depth - 1; ++j) {
+        for (int i = 0; i < width - 1; ++i) {
+            const GLuint k1 = j * width + i;
+            const GLuint k2 = k1 + width;
+            // counter-clockwise seen from above
+            indices.insert(indices.end(), {k1, k2, k1 + 1, k1 + 1, k2, k2 + 1});
+        }
+    }
+
+    initialize();
+    glGenBuffers(1, &ebo);
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+Heightfield::~Heightfield() { glDeleteBuffers(1, &ebo); }
+
+void Heightfield::generateVertices() { vertexPointer = &vertices; }
+
+void Heightfield::render(Program* shaderProgram) {
+    if (texture) {
+        shaderProgram->setUniform("useTexture", 1);
+        shaderProgram->setUniform("diffuseTexture", texture->getIndex());
+    } else {
+        shaderProgram->setUniform("useTexture", 0);
+        shaderProgram->setUniform("baseColor", baseColor);
+    }
+    shaderProgram->setUniform("model", modelMatrix);
+    shaderProgram->setUniform("invtransmodel", inverseTransposeModel);
+    glBindVertexArray(vao);
+    glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(indices.size()), GL_UNSIGNED_INT, nullptr);
+    glBindVertexArray(0);
+}
+
 Sphere::Sphere() {
     glGenVertexArrays(1, &wireVAO);
     if (vertexPointer == nullptr) {
@@ -410,14 +467,28 @@ void SoftCube::setTextures(const std::array<std::shared_ptr<Texture>, 6>& _textu
 void SoftCube::update() {
     // All vertex
     int nParticle = cube->getParticleNum();
-    auto particles = cube->getParticlePointer();
+    const auto& particles = cube->getParticles();
     int currentPos = -1;
     for (int i = 0; i < nParticle; ++i) {
-        const auto& pos = (*particles)[i].getPosition();
+        const auto pos = particles.getPosition(i);
         fullVertices[++currentPos] = pos[0];
         fullVertices[++currentPos] = pos[1];
         fullVertices[++currentPos] = pos[2];
     }
+    updateBuffers();
+}
+
+void SoftCube::update(const float* positions) {
+    std::copy(positions, positions + fullVertices.size(), fullVertices.begin());
+    updateBuffers();
+}
+
+void SoftCube::update(const float* previous, const float* next, float alpha) {
+    for (size_t i = 0; i < fullVertices.size(); ++i) fullVertices[i] = previous[i] + alpha * (next[i] - previous[i]);
+    updateBuffers();
+}
+
+void SoftCube::updateBuffers() {
     glBindBuffer(GL_ARRAY_BUFFER, vertexVBO);
     glBufferSubData(GL_ARRAY_BUFFER, 0, fullVertices.size() * sizeof(GLfloat), fullVertices.data());
     glBindBuffer(GL_ARRAY_BUFFER, 0);
@@ -446,6 +517,8 @@ void SoftCube::updateSingleFace(int face) {
     // Reset to 0
     auto temp = std::vector<std::vector<Eigen::Vector3f>>(
         edgeNum, std::vector<Eigen::Vector3f>(edgeNum, Eigen::Vector3f::Zero()));
+    // Positions come from fullVertices, which may be a played back frame rather than the simulated cube
+    const auto vertex = [this](const unsigned int index) { return Eigen::Vector3f::Map(&fullVertices[3 * index]); };
     // Use to flip normal
     float dFaceFactor = (face & 1) ? -1.0f : 1.0f;
     // Accumulate normals
@@ -453,10 +526,10 @@ void SoftCube::updateSingleFace(int face) {
         for (int j = 0; j < edgeNum - 1; ++j) {
             // V1   V4
             // V2   V3
-            Eigen::Vector3f V1 = cube->getParticle(cube->getPointMap(face, i, j)).getPosition();
-            Eigen::Vector3f V2 = cube->getParticle(cube->getPointMap(face, i + 1, j)).getPosition();
-            Eigen::Vector3f V3 = cube->getParticle(cube->getPointMap(face, i + 1, j + 1)).getPosition();
-            Eigen::Vector3f V4 = cube->getParticle(cube->getPointMap(face, i, j + 1)).getPosition();
+            Eigen::Vector3f V1 = vertex(cube->getPointMap(face, i, j));
+            Eigen::Vector3f V2 = vertex(cube->getPointMap(face, i + 1, j));
+            Eigen::Vector3f V3 = vertex(cube->getPointMap(face, i + 1, j + 1));
+            Eigen::Vector3f V4 = vertex(cube->getPointMap(face, i, j + 1));
 
             Eigen::Vector3f N = (V3 - V2).cross(V1 - V2);
             N *= dFaceFactor;
@@ -6,6 +6,7 @@
 #include "Eigen/Dense"
 
 #include "../simulation/cube.h"
+#include "../simulation/terrain.h"
 #include "shader.h"
 #include "texture.h"
 
@@ -47,6 +48,21 @@ class Plane final : public Rigidbody {
     static std::vector<GLfloat> vertices;
 };
 
+// Triangle mesh of a heightfield terrain, one vertex per height node. Vertices span the unit square like Plane's,
+// so the terrain's model matrix places both. The mesh is copied, the terrain may be destroyed afterwards.
+class Heightfield final : public Rigidbody {
+ public:
+    explicit Heightfield(const simulation::HeightfieldTerrain& terrain);
+    ~Heightfield();
+    void generateVertices() override;
+    void render(Program* shaderProgram) override;
+
+ private:
+    GLuint ebo;
+    std::vector<GLfloat> vertices;
+    std::vector<GLuint> indices;
+};
+
 class Sphere final : public Rigidbody {
  public:
     enum class RenderMode { WIREFRAME, FILLED };
@@ -91,6 +107,8 @@ class SoftCube final {
     void initializeBuffers();
     void allocateBuffers();
     void updateSingleFace(int face);
+    // upload fullVertices and the face normals derived from them
+    void updateBuffers();
 
  public:
     explicit SoftCube(simulation::Cube* _cube);
@@ -101,7 +119,12 @@ class SoftCube final {
 
     void setTextures(const std::array<std::shared_ptr<Texture>, 6>& _textures);
 
+    // read the positions of the simulated cube
     void update();
+    // take positions, 3 floats per particle, instead of those of the simulated cube
+    void update(const float* positions);
+    // positions linearly interpolated from previous (alpha 0) to next (alpha 1), as update(const float*)
+    void update(const float* previous, const float* next, float alpha);
 
     void renderCube(Program* shaderProgram);
     void renderPoints(Program* shaderProgram);
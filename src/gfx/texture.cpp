@@ -3,8 +3,7 @@
 #include <iostream>
 #include <string>
 
-#define STBI_ONLY_PNG
-#define STB_IMAGE_IMPLEMENTATION
+// implemented in util/image.cpp
 #include "stb_image.h"
 
 namespace gfx {
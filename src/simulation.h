@@ -8,5 +8,7 @@ This is the header for external usage of simulation classes.
 #include "simulation/integrator.h"
 #include "simulation/massSpringSystem.h"
 #include "simulation/particle.h"
+#include "simulation/particleStore.h"
+#include "simulation/simulationThread.h"
 #include "simulation/spring.h"
 #include "simulation/terrain.h"
@@ -1,8 +1,13 @@
 #include "cube.h"
 
-#include "Eigen/Dense"
+#include <algorithm>
+#include <bitset>
 #include <iostream>
+#include <stdexcept>
+
+#include "Eigen/Dense"
 #include "../util/helper.h"
+#include "../util/threadPool.h"
 namespace simulation {
 constexpr float g_cdK = 2500.0f;
 constexpr float g_cdD = 50.0f;
@@ -19,6 +24,7 @@ Cube::Cube()
       damperCoefBending(g_cdD) {
     particleNumPerFace = particleNumPerEdge * particleNumPerEdge;
     initializeParticle();
+    initializeSurfaceTriangle();
     initializeSpring();
 }
 
@@ -35,6 +41,7 @@ Cube::Cube(const Eigen::Vector3f &a_kInitPos, const float cubeLength, const int
       damperCoefBending(dDamperCoef) {
     particleNumPerFace = numAtEdge * numAtEdge;
     initializeParticle();
+    initializeSurfaceTriangle();
     initializeSpring();
 }
 
@@ -71,12 +78,26 @@ unsigned int Cube::getPointMap(const int a_ciSide, const int a_ciI, const int a_
     return r;
 }
 
-Particle &Cube::getParticle(int particleIdx) { return particles[particleIdx]; }
+Particle Cube::getParticle(int particleIdx) const { return particles.getParticle(particleIdx); }
 
-std::vector<Particle> *Cube::getParticlePointer() { return &particles; }
+ParticleStore &Cube::getParticles() { return particles; }
+
+const ParticleStore &Cube::getParticles() const { return particles; }
 
 Spring &Cube::getSpring(int springIdx) { return springs[springIdx]; }
 
+const SpringBatch &Cube::getSpringBatch() const { return springBatch; }
+
+ForceMode Cube::getForceMode() const { return forceMode; }
+
+int Cube::getSpringColorCount() const { return static_cast<int>(springColorOffsets.size()) - 1; }
+
+int Cube::getSpringColorBegin(const int color) const { return springColorOffsets[color]; }
+
+const std::vector<int> &Cube::getSurfaceParticles() const { return surfaceParticles; }
+
+const std::vector<int> &Cube::getSurfaceTriangles() const { return surfaceTriangles; }
+
 void Cube::setSpringCoef(const float springCoef, const Spring::SpringType springType) {
     if (springType == Spring::SpringType::STRUCT) {
         springCoefStruct = springCoef;
@@ -103,11 +124,13 @@ void Cube::setDamperCoef(const float damperCoef, const Spring::SpringType spring
     }
 }
 
+void Cube::setForceMode(const ForceMode mode) { forceMode = mode; }
+
 void Cube::resetCube(const Eigen::Vector3f &offset, const float &rotate) {
     float dTheta = util::radians(rotate);  //  change angle from degree to
                                            //  radian
 
-    for (unsigned int uiI = 0; uiI < particles.size(); uiI++) {
+    for (int uiI = 0; uiI < particles.size(); uiI++) {
         int i = uiI / particleNumPerFace;
         int j = (uiI / particleNumPerEdge) % particleNumPerEdge;
         int k = uiI % particleNumPerEdge;
@@ -122,81 +145,85 @@ void Cube::resetCube(const Eigen::Vector3f &offset, const float &rotate) {
 
         RotateVec = rotation * RotateVec;
 
-        particles[uiI].setPosition(initialPosition + offset + RotateVec);
-        particles[uiI].setForce(Eigen::Vector3f::Zero());
-        particles[uiI].setVelocity(Eigen::Vector3f::Zero());
+        particles.setPosition(uiI, initialPosition + offset + RotateVec);
+        particles.setForce(uiI, Eigen::Vector3f::Zero());
+        particles.setExternalForce(uiI, Eigen::Vector3f::Zero());
+        particles.setVelocity(uiI, Eigen::Vector3f::Zero());
     }
 }
 
 void Cube::addForceField(const Eigen::Vector3f &force) {
-    for (unsigned int uiI = 0; uiI < particles.size(); uiI++) {
-        particles[uiI].setAcceleration(force);
+    const float *mass = particles.massData();
+    const int particleNum = particles.size();
+    for (int axis = 0; axis < 3; ++axis) {
+        float *f = particles.forceData(axis);
+        const float *external = particles.externalForceData(axis);
+        const float acceleration = force[axis];
+        for (int uiI = 0; uiI < particleNum; uiI++) {
+            f[uiI] = acceleration * mass[uiI] + external[uiI];
+        }
     }
 }
 
 void Cube::computeInternalForce() {
-    Eigen::Vector3f spring_force_a = Eigen::Vector3f::Zero();
-    Eigen::Vector3f spring_force_b = Eigen::Vector3f::Zero();
-    Eigen::Vector3f damper_force_a = Eigen::Vector3f::Zero();
-    Eigen::Vector3f damper_force_b = Eigen::Vector3f::Zero();
-    int start_id = 0;
-    int end_id = 0;
-
-    for (int i = 0; i < springs.size(); i++) 
-    {
-        start_id = springs[i].getSpringStartID();
-        end_id = springs[i].getSpringEndID();
-
-        spring_force_a = computeSpringForce(particles[start_id].getPosition(), particles[end_id].getPosition(), 
-                                          springs[i].getSpringCoef(), springs[i].getSpringRestLength());
-        damper_force_a = computeDamperForce(particles[start_id].getPosition(), particles[end_id].getPosition(), 
-                                          particles[start_id].getVelocity(), particles[end_id].getVelocity(),
-                                          springs[i].getDamperCoef());        
-        spring_force_b = computeSpringForce(particles[end_id].getPosition(), particles[start_id].getPosition(),
-                                          springs[i].getSpringCoef(), springs[i].getSpringRestLength());
-        damper_force_b = computeDamperForce(particles[end_id].getPosition(), particles[start_id].getPosition(),
-                                          particles[end_id].getVelocity(), particles[start_id].getVelocity(),
-                                          springs[i].getDamperCoef());
-
-        particles[start_id].addForce(spring_force_a + damper_force_a);
-        particles[end_id].addForce(spring_force_b + damper_force_b);
+    // springs per parallel chunk, small colors are evaluated by the calling thread alone
+    constexpr int grain = 2048;
+    // particles per parallel chunk of the gather mode
+    constexpr int particleGrain = 128;
+
+    switch (forceMode) {
+        case ForceMode::Scatter:
+            accumulateSpringForce(springBatch, 0, springBatch.size(), particles);
+            break;
+        case ForceMode::Colored: {
+            util::ThreadPool &pool = util::ThreadPool::getInstance();
+            auto evaluate = [this](int begin, int end) { accumulateSpringForce(springBatch, begin, end, particles); };
+            for (int color = 0; color < getSpringColorCount(); ++color) {
+                pool.parallelFor(springColorOffsets[color], springColorOffsets[color + 1], grain, evaluate);
+            }
+            break;
+        }
+        case ForceMode::Gather:
+            util::ThreadPool::getInstance().parallelFor(
+                0, particles.size(), particleGrain,
+                [this](int begin, int end) { gatherSpringForce(springBatch, begin, end, particles); });
+            break;
     }
 }
 
-Eigen::Vector3f Cube::computeSpringForce(const Eigen::Vector3f &positionA, const Eigen::Vector3f &positionB,
-                                         const float springCoef, const float restLength) {
-    Eigen::Vector3f f = Eigen::Vector3f::Zero();
-
-    f = -springCoef * 
-        (fabs((positionA - positionB).norm()) - restLength) *
-        ((positionA - positionB) / (fabs((positionA - positionB).norm())));
-
-    return f;
-}
-
-Eigen::Vector3f Cube::computeDamperForce(const Eigen::Vector3f &positionA, const Eigen::Vector3f &positionB,
-                                         const Eigen::Vector3f &velocityA, const Eigen::Vector3f &velocityB,
-                                         const float damperCoef) {
-    Eigen::Vector3f f = Eigen::Vector3f::Zero();
-
-    f = -damperCoef * 
-        (((velocityA - velocityB).dot(positionA - positionB)) / (fabs((positionA - positionB).norm()))) * 
-        ((positionA - positionB) / (fabs((positionA - positionB).norm())));
-
-    return f;
-}
-
 void Cube::initializeParticle() {
+    particles.resize(particleNumPerEdge * particleNumPerFace);
+    surfaceParticles.clear();
+    int particleID = 0;
     for (int i = 0; i < particleNumPerEdge; i++) {
         for (int j = 0; j < particleNumPerEdge; j++) {
             for (int k = 0; k < particleNumPerEdge; k++) {
-                Particle Particle;
                 float offset_x = (float)((i - particleNumPerEdge / 2) * cubeLength / (particleNumPerEdge - 1));
                 float offset_y = (float)((j - particleNumPerEdge / 2) * cubeLength / (particleNumPerEdge - 1));
                 float offset_z = (float)((k - particleNumPerEdge / 2) * cubeLength / (particleNumPerEdge - 1));
-                Particle.setPosition(Eigen::Vector3f(initialPosition(0) + offset_x, initialPosition(1) + offset_y,
-                                                     initialPosition(2) + offset_z));
-                particles.push_back(Particle);
+                particles.setMass(particleID, 1.0f);
+                const bool inside = i > 0 && j > 0 && k > 0 && i < particleNumPerEdge - 1 &&
+                                    j < particleNumPerEdge - 1 && k < particleNumPerEdge - 1;
+                if (!inside) surfaceParticles.push_back(particleID);
+                particles.setPosition(particleID, Eigen::Vector3f(initialPosition(0) + offset_x,
+                                                                  initialPosition(1) + offset_y,
+                                                                  initialPosition(2) + offset_z));
+                ++particleID;
+            }
+        }
+    }
+}
+
+void Cube::initializeSurfaceTriangle() {
+    surfaceTriangles.clear();
+    for (int side = 1; side <= 6; side++) {
+        for (int i = 0; i < particleNumPerEdge - 1; i++) {
+            for (int j = 0; j < particleNumPerEdge - 1; j++) {
+                const int k1 = getPointMap(side, i, j);
+                const int k2 = getPointMap(side, i + 1, j);
+                const int k3 = getPointMap(side, i + 1, j + 1);
+                const int k4 = getPointMap(side, i, j + 1);
+                surfaceTriangles.insert(surfaceTriangles.end(), {k1, k2, k3, k1, k3, k4});
             }
         }
     }
@@ -204,7 +231,7 @@ void Cube::initializeParticle() {
 
 void Cube::pushSpringLine(const int particleID, const int neighborID, Spring::SpringType springType) 
 {
-    float length = fabs((particles[particleID].getPosition() - particles[neighborID].getPosition()).norm());
+    float length = fabs((particles.getPosition(particleID) - particles.getPosition(neighborID)).norm());
     
     switch (springType) {
         case Spring::SpringType::STRUCT:
@@ -390,8 +417,8 @@ void Cube::initializeSpringShearLine(const int particleID, const int i, const in
 void Cube::initializeSpring() {
     int iParticleID = 0;
     int iNeighborID = 0;
-    Eigen::Vector3f SpringStartPos = particles[iParticleID].getPosition();
-    Eigen::Vector3f SpringEndPos = particles[iNeighborID].getPosition();
+    Eigen::Vector3f SpringStartPos = particles.getPosition(iParticleID);
+    Eigen::Vector3f SpringEndPos = particles.getPosition(iNeighborID);
     Eigen::Vector3f Length = SpringStartPos - SpringEndPos;
 
     enum {
@@ -403,12 +430,48 @@ void Cube::initializeSpring() {
     initalizeSpringBending();
     initalizeSpringStruct();
     initializeSpringShear();
+    colorSprings();
+    springBatch.assign(springs, particles.size());
+}
+
+void Cube::colorSprings() {
+    // Greedy coloring, the lattice has at most 32 springs per particle so 2 * 32 - 1 colors always suffice.
+    constexpr int maxColor = 64;
+    std::vector<std::bitset<maxColor>> usedColors(particles.size());
+    std::vector<int> springColor(springs.size());
+    int colorCount = 0;
+
+    for (int i = 0; i < springs.size(); ++i) {
+        const int start_id = springs[i].getSpringStartID();
+        const int end_id = springs[i].getSpringEndID();
+        const std::bitset<maxColor> used = usedColors[start_id] | usedColors[end_id];
+        int color = 0;
+        while (color < maxColor && used[color]) ++color;
+        if (color == maxColor) {
+            throw std::runtime_error("Cube::colorSprings : too many spring colors");
+        }
+        usedColors[start_id].set(color);
+        usedColors[end_id].set(color);
+        springColor[i] = color;
+        colorCount = std::max(colorCount, color + 1);
+    }
+
+    // counting sort by color, springs keep their relative order inside a color
+    springColorOffsets.assign(colorCount + 1, 0);
+    for (int i = 0; i < springs.size(); ++i) ++springColorOffsets[springColor[i] + 1];
+    for (int color = 0; color < colorCount; ++color) springColorOffsets[color + 1] += springColorOffsets[color];
+
+    std::vector<int> slot(springColorOffsets.begin(), springColorOffsets.end() - 1);
+    std::vector<Spring> sortedSprings(springs);
+    for (int i = 0; i < springs.size(); ++i) sortedSprings[slot[springColor[i]]++] = springs[i];
+    springs = std::move(sortedSprings);
 }
 
 void Cube::updateSpringCoef(const float a_cdSpringCoef, const Spring::SpringType a_cSpringType) {
     for (unsigned int uiI = 0; uiI < springs.size(); uiI++) {
         if (springs[uiI].getType() == a_cSpringType) {
             springs[uiI].setSpringCoef(a_cdSpringCoef);
+            springBatch.setSpringCoef(uiI, a_cdSpringCoef);
         }
     }
 }
@@ -417,6 +480,7 @@ void Cube::updateDamperCoef(const float a_cdDamperCoef, const Spring::SpringType
     for (unsigned int uiI = 0; uiI < springs.size(); uiI++) {
         if (springs[uiI].getType() == a_cSpringType) {
             springs[uiI].setDamperCoef(a_cdDamperCoef);
+            springBatch.setDamperCoef(uiI, a_cdDamperCoef);
         }
     }
 }
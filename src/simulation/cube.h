@@ -2,9 +2,18 @@
 #include <vector>
 
 #include "particle.h"
+#include "particleStore.h"
 #include "spring.h"
+#include "springKernel.h"
 
 namespace simulation {
+// How Cube::computeInternalForce walks the springs.
+enum class ForceMode : char {
+    Scatter,  // single thread, spring by spring
+    Colored,  // springs grouped by color, each color evaluated in parallel
+    Gather,   // every particle sums its own incident springs in parallel
+};
+
 class Cube {
  public:
     Cube();
@@ -19,11 +28,23 @@ class Cube {
     int getNumAtEdge() const;    // return number of particles at edge
     // return index used to access particle at face
     unsigned int getPointMap(const int a_ciSide, const int a_ciI, const int a_ciJ);
-    // get a particle in container according to index
-    Particle &getParticle(int particleIdx);
-    std::vector<Particle> *getParticlePointer();
+    // get a copy of a particle in container according to index
+    Particle getParticle(int particleIdx) const;
+    // structure-of-arrays storage of all particles, used by the hot loops
+    ParticleStore &getParticles();
+    const ParticleStore &getParticles() const;
     // get a spring in container according to index
     Spring &getSpring(int springIdx);
+    // packed springs in the same order as getSpring
+    const SpringBatch &getSpringBatch() const;
+    ForceMode getForceMode() const;
+    int getSpringColorCount() const;  // return number of spring colors
+    // springs of color c are [getSpringColorBegin(c), getSpringColorBegin(c + 1)) and share no particle
+    int getSpringColorBegin(const int color) const;
+    // indices of the particles on the cube's faces, in increasing order
+    const std::vector<int> &getSurfaceParticles() const;
+    // two triangles per quad of every face, triangle t is particles [3t], [3t + 1] and [3t + 2] of the list
+    const std::vector<int> &getSurfaceTriangles() const;
 
     //==========================================
     //  setter
@@ -31,13 +52,14 @@ class Cube {
 
     void setSpringCoef(const float springCoef, const Spring::SpringType springType);
     void setDamperCoef(const float damperCoef, const Spring::SpringType springType);
+    void setForceMode(const ForceMode mode);
 
     //==========================================
     //  method
     //==========================================
     // set rotation and offset of the cube
     void resetCube(const Eigen::Vector3f &offset, const float &rotate);
-    // add gravity
+    // add gravity, plus the external forces held by the particles
     void addForceField(const Eigen::Vector3f &force);
     void computeInternalForce();
     // delegate collision detection to terrain
@@ -55,24 +77,27 @@ class Cube {
     float cubeLength;
     Eigen::Vector3f initialPosition;
 
-    std::vector<Particle> particles;
+    ParticleStore particles;
+    std::vector<int> surfaceParticles;
+    std::vector<int> surfaceTriangles;
     std::vector<Spring> springs;
+    SpringBatch springBatch;  // packed copy of springs for the force kernel
+    // springs are sorted by color, color c owns [springColorOffsets[c], springColorOffsets[c + 1]) and no two
+    // springs of one color share a particle
+    std::vector<int> springColorOffsets;
+    ForceMode forceMode = ForceMode::Scatter;
 
     //==========================================
     //  internal method
     //==========================================
     void initializeParticle();
+    void initializeSurfaceTriangle();
     void initializeSpring();
+    void colorSprings();
 
     void updateSpringCoef(const float springCoef, const Spring::SpringType springType);
     void updateDamperCoef(const float damperCoef, const Spring::SpringType springType);
 
-    Eigen::Vector3f computeSpringForce(const Eigen::Vector3f &positionA, const Eigen::Vector3f &positionB,
-                                       const float springCoef, const float restLength);
-    Eigen::Vector3f computeDamperForce(const Eigen::Vector3f &positionA, const Eigen::Vector3f &positionB,
-                                       const Eigen::Vector3f &velocityA, const Eigen::Vector3f &velocityB,
-                                       const float damperCoef);
-
 private:
     void initalizeSpringBending();
     void initalizeSpringStruct();
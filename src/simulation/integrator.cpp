@@ -1,8 +1,12 @@
 #include "integrator.h"
 
+#include <algorithm>
+#include <cmath>
 #include <vector>
 #include <iostream>
 
+#include "../util/threadPool.h"
+
 namespace simulation {
 // Factory
 std::unique_ptr<Integrator> IntegratorFactory::CreateIntegrator(IntegratorType type) {
@@ -15,6 +19,14 @@ std::unique_ptr<Integrator> IntegratorFactory::CreateIntegrator(IntegratorType t
             return std::make_unique<MidpointEulerIntegrator>();
         case simulation::IntegratorType::RungeKuttaFourth:
             return std::make_unique<RungeKuttaFourthIntegrator>();
+        case simulation::IntegratorType::BackwardEuler:
+            return std::make_unique<BackwardEulerIntegrator>();
+        case simulation::IntegratorType::ProjectiveDynamics:
+            return std::make_unique<ProjectiveDynamicsIntegrator>();
+        case simulation::IntegratorType::XPBD:
+            return std::make_unique<XPBDIntegrator>();
+        case simulation::IntegratorType::DormandPrince:
+            return std::make_unique<DormandPrinceIntegrator>();
         default:
             throw std::invalid_argument("TerrainFactory::CreateTerrain : invalid TerrainType");
             break;
@@ -22,19 +34,60 @@ std::unique_ptr<Integrator> IntegratorFactory::CreateIntegrator(IntegratorType t
     return nullptr;
 }
 
+//
+// Integrator
+//
+
+void Integrator::integrate(MassSpringSystem& particleSystem) {
+    const int cubeCount = particleSystem.getCubeCount();
+    const float deltaTime = particleSystem.deltaTime;
+    reserveCubes(cubeCount);
+    util::ThreadPool::getInstance().parallelFor(0, cubeCount, 1, [&](int begin, int end) {
+        for (int cubeIdx = begin; cubeIdx < end; ++cubeIdx) {
+            if (cubeStepper) {
+                cubeStepper(*this, particleSystem, cubeIdx, deltaTime);
+            } else {
+                integrateCube(particleSystem, cubeIdx, deltaTime);
+            }
+        }
+    });
+}
+
+void Integrator::reserveCubes(const int cubeCount) {
+    if (static_cast<int>(workspaces.size()) < cubeCount) workspaces.resize(cubeCount);
+}
+
 //
 // ExplicitEulerIntegrator
 //
 
 IntegratorType ExplicitEulerIntegrator::getType() { return IntegratorType::ExplicitEuler; }
 
-void ExplicitEulerIntegrator::integrate(MassSpringSystem& particleSystem) {
-    std::vector<Particle> * particles = particleSystem.getCubePointer(0)->getParticlePointer();
-    Eigen::Vector3f offset = Eigen::Vector3f::Zero();
+void ExplicitEulerIntegrator::integrateCube(MassSpringSystem& particleSystem, const int cubeIdx,
+                                            const float deltaTime) {
+    advanceCube<Terrain>(particleSystem, cubeIdx, deltaTime);
+}
+
+Integrator::CubeStepper ExplicitEulerIntegrator::getCubeStepper(const TerrainType type) const {
+    return selectCubeStepper<ExplicitEulerIntegrator>(type);
+}
+
+template <typename TerrainT>
+void ExplicitEulerIntegrator::advanceCube(MassSpringSystem& particleSystem, const int cubeIdx,
+                                          const float deltaTime) {
+    Cube& cube = *particleSystem.getCubePointer(cubeIdx);
+    particleSystem.computeCubeForce<TerrainT>(cube, deltaTime);
+    ParticleStore& particles = cube.getParticles();
+    const float* inverseMass = particles.inverseMassData();
 
-    for (int i = 0; i < particles->size(); ++i) {
-        (*particles)[i].addVelocity((*particles)[i].getAcceleration() * particleSystem.deltaTime);
-        (*particles)[i].addPosition((*particles)[i].getVelocity() * particleSystem.deltaTime);
+    for (int axis = 0; axis < 3; ++axis) {
+        float* position = particles.positionData(axis);
+        float* velocity = particles.velocityData(axis);
+        const float* force = particles.forceData(axis);
+        for (int i = 0; i < particles.size(); ++i) {
+            velocity[i] += force[i] * inverseMass[i] * deltaTime;
+            position[i] += velocity[i] * deltaTime;
+        }
     }
 }
 
@@ -44,15 +97,39 @@ void ExplicitEulerIntegrator::integrate(MassSpringSystem& particleSystem) {
 
 IntegratorType ImplicitEulerIntegrator::getType() { return IntegratorType::ImplicitEuler; }
 
-void ImplicitEulerIntegrator::integrate(MassSpringSystem& particleSystem) {
-    Cube next_cube = *particleSystem.getCubePointer(0);
-    std::vector<Particle> * next_particles = next_cube.getParticlePointer();
-    std::vector<Particle> * particles = particleSystem.getCubePointer(0)->getParticlePointer();
-    particleSystem.computeCubeForce(next_cube);
+void ImplicitEulerIntegrator::integrateCube(MassSpringSystem& particleSystem, const int cubeIdx,
+                                            const float deltaTime) {
+    advanceCube<Terrain>(particleSystem, cubeIdx, deltaTime);
+}
+
+Integrator::CubeStepper ImplicitEulerIntegrator::getCubeStepper(const TerrainType type) const {
+    return selectCubeStepper<ImplicitEulerIntegrator>(type);
+}
+
+template <typename TerrainT>
+void ImplicitEulerIntegrator::advanceCube(MassSpringSystem& particleSystem, const int cubeIdx,
+                                          const float deltaTime) {
+    Cube& cube = *particleSystem.getCubePointer(cubeIdx);
+    particleSystem.computeCubeForce<TerrainT>(cube, deltaTime);
+    ParticleStore& particles = cube.getParticles();
+    const float* inverseMass = particles.inverseMassData();
+    IntegratorWorkspace& workspace = workspaces[cubeIdx];
+    workspace.reserve(1, particles);
+    workspace.save(particles, 0);
 
-    for (int i = 0; i < particles->size(); ++i) {
-        (*particles)[i].addVelocity((*next_particles)[i].getAcceleration() * particleSystem.deltaTime);
-        (*particles)[i].addPosition((*particles)[i].getVelocity() * particleSystem.deltaTime);
+    // evaluate the force again at the state left by collision handling, then discard what the second collision
+    // pass changed in the state
+    particleSystem.computeCubeForce<TerrainT>(cube, deltaTime);
+    workspace.restore(0, particles);
+
+    for (int axis = 0; axis < 3; ++axis) {
+        float* position = particles.positionData(axis);
+        float* velocity = particles.velocityData(axis);
+        const float* force = particles.forceData(axis);
+        for (int i = 0; i < particles.size(); ++i) {
+            velocity[i] += force[i] * inverseMass[i] * deltaTime;
+            position[i] += velocity[i] * deltaTime;
+        }
     }
 }
 
@@ -62,22 +139,49 @@ void ImplicitEulerIntegrator::integrate(MassSpringSystem& particleSystem) {
 
 IntegratorType MidpointEulerIntegrator::getType() { return IntegratorType::MidpointEuler; }
 
-void MidpointEulerIntegrator::integrate(MassSpringSystem& particleSystem) {
-    // TODO
-    // For midpoint euler, the deltaTime passed in is correct.
-    // But this deltaTime is for a full step.
-    // So you may need to adjust it before computing, but don't forget to restore original value.
+void MidpointEulerIntegrator::integrateCube(MassSpringSystem& particleSystem, const int cubeIdx,
+                                            const float deltaTime) {
+    advanceCube<Terrain>(particleSystem, cubeIdx, deltaTime);
+}
+
+Integrator::CubeStepper MidpointEulerIntegrator::getCubeStepper(const TerrainType type) const {
+    return selectCubeStepper<MidpointEulerIntegrator>(type);
+}
+
+template <typename TerrainT>
+void MidpointEulerIntegrator::advanceCube(MassSpringSystem& particleSystem, const int cubeIdx,
+                                          const float deltaTime) {
+    Cube& cube = *particleSystem.getCubePointer(cubeIdx);
+    particleSystem.computeCubeForce<TerrainT>(cube, deltaTime);
+    ParticleStore& particles = cube.getParticles();
+    const float* inverseMass = particles.inverseMassData();
+    IntegratorWorkspace& workspace = workspaces[cubeIdx];
+    workspace.reserve(1, particles);
+    workspace.save(particles, 0);
 
-    Cube mid_cube = *particleSystem.getCubePointer(0);
-    std::vector<Particle> * mid_particles = mid_cube.getParticlePointer(); 
-    std::vector<Particle> * particles = particleSystem.getCubePointer(0)->getParticlePointer();
-    particleSystem.deltaTime /= 2;
-    particleSystem.computeCubeForce(mid_cube);
-    particleSystem.deltaTime *= 2;
+    // half step to the midpoint, collision there is handled for half of the step
+    for (int axis = 0; axis < 3; ++axis) {
+        float* position = particles.positionData(axis);
+        float* velocity = particles.velocityData(axis);
+        const float* force = particles.forceData(axis);
+        for (int i = 0; i < particles.size(); ++i) {
+            position[i] += velocity[i] * deltaTime / 2;
+            velocity[i] += force[i] * inverseMass[i] * deltaTime / 2;
+        }
+    }
+    particleSystem.computeCubeForce<TerrainT>(cube, deltaTime / 2);
 
-    for (int i = 0; i < particles->size(); ++i) {
-        (*particles)[i].addVelocity((*mid_particles)[i].getAcceleration() * particleSystem.deltaTime);
-        (*particles)[i].addPosition((*particles)[i].getVelocity() * particleSystem.deltaTime);
+    // full step with the derivative at the midpoint
+    for (int axis = 0; axis < 3; ++axis) {
+        float* position = particles.positionData(axis);
+        float* velocity = particles.velocityData(axis);
+        const float* force = particles.forceData(axis);
+        const float* startPosition = workspace.positionData(0, axis);
+        const float* startVelocity = workspace.velocityData(0, axis);
+        for (int i = 0; i < particles.size(); ++i) {
+            position[i] = startPosition[i] + velocity[i] * deltaTime;
+            velocity[i] = startVelocity[i] + force[i] * inverseMass[i] * deltaTime;
+        }
     }
 }
 
@@ -87,53 +191,631 @@ void MidpointEulerIntegrator::integrate(MassSpringSystem& particleSystem) {
 
 IntegratorType RungeKuttaFourthIntegrator::getType() { return IntegratorType::RungeKuttaFourth; }
 
-void RungeKuttaFourthIntegrator::integrate(MassSpringSystem& particleSystem) {
-    struct StateStep {
-        Eigen::Vector3f deltaVel;
-        Eigen::Vector3f deltaPos;
-    };
-    // TODO
-    // StateStep struct is just a hint, you can use whatever you want.
-    Cube temp_cube = *particleSystem.getCubePointer(0);
-    std::vector<Particle> k1_particles, k2_particles, k3_particles, k4_particles;
-    std::vector<Particle> * particles = particleSystem.getCubePointer(0)->getParticlePointer();
-    float time = particleSystem.deltaTime;
-
-    k1_particles = *temp_cube.getParticlePointer();
-    for (int i = 0; i < particles->size(); ++i) {
-        k1_particles[i].addVelocity((*particles)[i].getAcceleration() * time);
-        k1_particles[i].addPosition(k1_particles[i].getVelocity() * time);
-    }
-
-    particleSystem.deltaTime /= 2;
-    particleSystem.computeCubeForce(temp_cube);
-    k2_particles = *temp_cube.getParticlePointer();    
-    for (int i = 0; i < particles->size(); ++i) {
-        k2_particles[i].addVelocity(k1_particles[i].getAcceleration() * time / 2);
-        k2_particles[i].addPosition(k2_particles[i].getVelocity() * time / 2);
-    }
-
-    particleSystem.computeCubeForce(temp_cube);
-    k3_particles = *temp_cube.getParticlePointer();
-    for (int i = 0; i < particles->size(); ++i) {
-        k3_particles[i].addVelocity(k2_particles[i].getAcceleration() * time / 2);
-        k3_particles[i].addPosition(k3_particles[i].getVelocity() * time / 2);
-    }
-    
-    particleSystem.deltaTime = time;
-    particleSystem.computeCubeForce(temp_cube);
-    k4_particles = *temp_cube.getParticlePointer();
-    for (int i = 0; i < particles->size(); ++i) {
-        k4_particles[i].addVelocity(k3_particles[i].getAcceleration() * time);
-        k4_particles[i].addPosition(k4_particles[i].getVelocity() * time);
-    }
-    
-    for (int i = 0; i < particles->size(); ++i) {
-        (*particles)[i].addVelocity((1.0f / 6.0f) *
-                                    (k1_particles[i].getAcceleration() + 2 * k2_particles[i].getAcceleration() +
-                                        2 * k3_particles[i].getAcceleration() + k4_particles[i].getAcceleration()) *
-                                    particleSystem.deltaTime);
-        (*particles)[i].addPosition((*particles)[i].getVelocity() * particleSystem.deltaTime);
+void RungeKuttaFourthIntegrator::integrateCube(MassSpringSystem& particleSystem, const int cubeIdx,
+                                               const float deltaTime) {
+    advanceCube<Terrain>(particleSystem, cubeIdx, deltaTime);
+}
+
+Integrator::CubeStepper RungeKuttaFourthIntegrator::getCubeStepper(const TerrainType type) const {
+    return selectCubeStepper<RungeKuttaFourthIntegrator>(type);
+}
+
+template <typename TerrainT>
+void RungeKuttaFourthIntegrator::advanceCube(MassSpringSystem& particleSystem, const int cubeIdx,
+                                             const float deltaTime) {
+    // stage s is evaluated at the start state plus stageStep[s] times the derivative of stage s - 1, and its
+    // derivative enters the result with weight stageWeight[s]
+    constexpr float stageStep[4] = {0.0f, 0.5f, 0.5f, 1.0f};
+    constexpr float stageWeight[4] = {1.0f / 6.0f, 2.0f / 6.0f, 2.0f / 6.0f, 1.0f / 6.0f};
+    Cube& cube = *particleSystem.getCubePointer(cubeIdx);
+    particleSystem.computeCubeForce<TerrainT>(cube, deltaTime);
+    ParticleStore& particles = cube.getParticles();
+    const float* inverseMass = particles.inverseMassData();
+    IntegratorWorkspace& workspace = workspaces[cubeIdx];
+    // workspace stage 0 holds the start state, stage 1 the weighted sum of the derivatives
+    workspace.reserve(2, particles);
+    workspace.save(particles, 0);
+    workspace.clear(1);
+
+    for (int stage = 1; stage <= 4; ++stage) {
+        // the derivative of the previous stage is its velocity after collision handling and its acceleration
+        const float weight = stageWeight[stage - 1];
+        const float step = stage < 4 ? stageStep[stage] * deltaTime : 0.0f;
+        for (int axis = 0; axis < 3; ++axis) {
+            float* position = particles.positionData(axis);
+            float* velocity = particles.velocityData(axis);
+            const float* force = particles.forceData(axis);
+            const float* startPosition = workspace.positionData(0, axis);
+            const float* startVelocity = workspace.velocityData(0, axis);
+            float* sumPosition = workspace.positionData(1, axis);
+            float* sumVelocity = workspace.velocityData(1, axis);
+            for (int i = 0; i < particles.size(); ++i) {
+                const float acceleration = force[i] * inverseMass[i];
+                sumPosition[i] += weight * velocity[i];
+                sumVelocity[i] += weight * acceleration;
+                position[i] = startPosition[i] + step * velocity[i];
+                velocity[i] = startVelocity[i] + step * acceleration;
+            }
+        }
+        if (stage < 4) particleSystem.computeCubeForce<TerrainT>(cube, step);
+    }
+
+    for (int axis = 0; axis < 3; ++axis) {
+        float* position = particles.positionData(axis);
+        float* velocity = particles.velocityData(axis);
+        const float* startPosition = workspace.positionData(0, axis);
+        const float* startVelocity = workspace.velocityData(0, axis);
+        const float* sumPosition = workspace.positionData(1, axis);
+        const float* sumVelocity = workspace.velocityData(1, axis);
+        for (int i = 0; i < particles.size(); ++i) {
+            position[i] = startPosition[i] + sumPosition[i] * deltaTime;
+            velocity[i] = startVelocity[i] + sumVelocity[i] * deltaTime;
+        }
+    }
+}
+
+//
+// BackwardEulerIntegrator
+//
+
+IntegratorType BackwardEulerIntegrator::getType() { return IntegratorType::BackwardEuler; }
+
+void BackwardEulerIntegrator::reserveCubes(const int cubeCount) {
+    Integrator::reserveCubes(cubeCount);
+    if (static_cast<int>(states.size()) < cubeCount) states.resize(cubeCount);
+}
+
+void BackwardEulerIntegrator::integrateCube(MassSpringSystem& particleSystem, const int cubeIdx,
+                                            const float deltaTime) {
+    Cube& cube = *particleSystem.getCubePointer(cubeIdx);
+    // contact is resolved by projection after the solve, the velocity band of handleCollision is stepped over at
+    // the time steps this integrator is meant for
+    cube.addForceField(particleSystem.gravity);
+    cube.computeInternalForce();
+    ParticleStore& particles = cube.getParticles();
+    const int n = particles.size();
+    const float h = deltaTime;
+    CubeState& state = states[cubeIdx];
+    Eigen::MatrixX3f& previousPosition = state.previousPosition;
+    Eigen::MatrixX3f& predictedPosition = state.predictedPosition;
+    Eigen::VectorXf& rhs = state.rhs;
+    Eigen::VectorXf& deltaVelocity = state.deltaVelocity;
+    Eigen::VectorXf& residual = state.residual;
+    Eigen::VectorXf& preconditioned = state.preconditioned;
+    Eigen::VectorXf& search = state.search;
+    Eigen::VectorXf& product = state.product;
+    const Eigen::VectorXf& inverseDiagonal = state.inverseDiagonal;
+
+    linearize(cube, h, state);
+    rhs.resize(3 * n);
+    deltaVelocity.resize(3 * n);
+    residual.resize(3 * n);
+    preconditioned.resize(3 * n);
+    search.resize(3 * n);
+    product.resize(3 * n);
+
+    // rhs = h * f + h^2 * df/dx * v, the stiffness product carries the minus sign of df/dx
+    for (int axis = 0; axis < 3; ++axis) {
+        search.segment(axis * n, n) = Eigen::Map<const Eigen::VectorXf>(particles.velocityData(axis), n);
+        rhs.segment(axis * n, n) = h * Eigen::Map<const Eigen::VectorXf>(particles.forceData(axis), n);
+    }
+    multiply(cube, state, search, product, 0.0f, h * h, 0.0f);
+    rhs -= product;
+
+    // Jacobi preconditioned conjugate gradient, starting from dv = 0
+    deltaVelocity.setZero();
+    residual = rhs;
+    preconditioned = inverseDiagonal.cwiseProduct(residual);
+    search = preconditioned;
+    float rho = residual.dot(preconditioned);
+    const float threshold = tolerance * tolerance * rhs.squaredNorm();
+    for (int iteration = 0; iteration < maxIterations && residual.squaredNorm() > threshold; ++iteration) {
+        multiply(cube, state, search, product, 1.0f, h * h, h);
+        const float alpha = rho / search.dot(product);
+        deltaVelocity += alpha * search;
+        residual -= alpha * product;
+        preconditioned = inverseDiagonal.cwiseProduct(residual);
+        const float nextRho = residual.dot(preconditioned);
+        search = preconditioned + (nextRho / rho) * search;
+        rho = nextRho;
+    }
+
+    previousPosition.resize(n, 3);
+    predictedPosition.resize(n, 3);
+    for (int axis = 0; axis < 3; ++axis) {
+        float* position = particles.positionData(axis);
+        float* velocity = particles.velocityData(axis);
+        const float* dv = deltaVelocity.data() + axis * n;
+        for (int i = 0; i < n; ++i) {
+            previousPosition(i, axis) = position[i];
+            velocity[i] += dv[i];
+            position[i] += velocity[i] * h;
+            predictedPosition(i, axis) = position[i];
+        }
+    }
+
+    // Push penetrating particles back by their depth, whatever distance they covered in the step, and remove the
+    // velocity that carried them in, as the XPBD integrator does
+    particleSystem.terrain->projectContact(previousPosition, cube);
+    for (int axis = 0; axis < 3; ++axis) {
+        const float* position = particles.positionData(axis);
+        float* velocity = particles.velocityData(axis);
+        for (int i = 0; i < n; ++i) velocity[i] += (position[i] - predictedPosition(i, axis)) / h;
+    }
+}
+
+void BackwardEulerIntegrator::linearize(const Cube& cube, const float deltaTime, CubeState& state) {
+    const ParticleStore& particles = cube.getParticles();
+    const SpringBatch& springs = cube.getSpringBatch();
+    const int n = particles.size();
+    const int springNum = springs.size();
+    state.directionX.resize(springNum);
+    state.directionY.resize(springNum);
+    state.directionZ.resize(springNum);
+    state.transverseStiffness.resize(springNum);
+    state.axialStiffness.resize(springNum);
+    state.inverseDiagonal.resize(3 * n);
+    Eigen::VectorXf& inverseDiagonal = state.inverseDiagonal;
+
+    for (int i = 0; i < n; ++i) {
+        const float mass = particles.getMass(i);
+        inverseDiagonal[i] = inverseDiagonal[n + i] = inverseDiagonal[2 * n + i] = mass;
+    }
+    const float h2 = deltaTime * deltaTime;
+    for (int s = 0; s < springNum; ++s) {
+        const int a = springs.startData()[s];
+        const int b = springs.endData()[s];
+        const Eigen::Vector3f delta = particles.getPosition(a) - particles.getPosition(b);
+        const float length = delta.norm();
+        const Eigen::Vector3f direction = delta / length;
+        const float springCoef = springs.springCoefData()[s];
+        const float transverse = std::max(springCoef * (1.0f - springs.restLengthData()[s] / length), 0.0f);
+        state.directionX[s] = direction[0];
+        state.directionY[s] = direction[1];
+        state.directionZ[s] = direction[2];
+        state.transverseStiffness[s] = transverse;
+        state.axialStiffness[s] = springCoef - transverse;
+        // diagonal of the system matrix, both endpoints receive the same block
+        const float axial = h2 * (springCoef - transverse) + deltaTime * springs.damperCoefData()[s];
+        for (int axis = 0; axis < 3; ++axis) {
+            const float diagonal = h2 * transverse + axial * direction[axis] * direction[axis];
+            inverseDiagonal[axis * n + a] += diagonal;
+            inverseDiagonal[axis * n + b] += diagonal;
+        }
+    }
+    inverseDiagonal = inverseDiagonal.cwiseInverse();
+}
+
+void BackwardEulerIntegrator::multiply(const Cube& cube, const CubeState& state, const Eigen::VectorXf& in,
+                                       Eigen::VectorXf& out, const float massScale, const float stiffnessScale,
+                                       const float dampingScale) {
+    const float* directionX = state.directionX.data();
+    const float* directionY = state.directionY.data();
+    const float* directionZ = state.directionZ.data();
+    const float* transverseStiffness = state.transverseStiffness.data();
+    const float* axialStiffness = state.axialStiffness.data();
+    const ParticleStore& particles = cube.getParticles();
+    const SpringBatch& springs = cube.getSpringBatch();
+    const int n = particles.size();
+    const float* inX = in.data();
+    const float* inY = inX + n;
+    const float* inZ = inY + n;
+    float* outX = out.data();
+    float* outY = outX + n;
+    float* outZ = outY + n;
+
+    const Eigen::Map<const Eigen::VectorXf> mass(particles.massData(), n);
+    for (int axis = 0; axis < 3; ++axis) {
+        out.segment(axis * n, n) = massScale * mass.cwiseProduct(in.segment(axis * n, n));
+    }
+    for (int s = 0; s < springs.size(); ++s) {
+        const int a = springs.startData()[s];
+        const int b = springs.endData()[s];
+        const float dx = inX[a] - inX[b];
+        const float dy = inY[a] - inY[b];
+        const float dz = inZ[a] - inZ[b];
+        const float projection = directionX[s] * dx + directionY[s] * dy + directionZ[s] * dz;
+        const float transverse = stiffnessScale * transverseStiffness[s];
+        const float axial =
+            (stiffnessScale * axialStiffness[s] + dampingScale * springs.damperCoefData()[s]) * projection;
+        const float gx = transverse * dx + axial * directionX[s];
+        const float gy = transverse * dy + axial * directionY[s];
+        const float gz = transverse * dz + axial * directionZ[s];
+        outX[a] += gx;
+        outY[a] += gy;
+        outZ[a] += gz;
+        outX[b] -= gx;
+        outY[b] -= gy;
+        outZ[b] -= gz;
+    }
+}
+
+//
+// ProjectiveDynamicsIntegrator
+//
+
+IntegratorType ProjectiveDynamicsIntegrator::getType() { return IntegratorType::ProjectiveDynamics; }
+
+void ProjectiveDynamicsIntegrator::reserveCubes(const int cubeCount) {
+    Integrator::reserveCubes(cubeCount);
+    if (static_cast<int>(states.size()) < cubeCount) states.resize(cubeCount);
+}
+
+void ProjectiveDynamicsIntegrator::integrateCube(MassSpringSystem& particleSystem, const int cubeIdx,
+                                                 const float deltaTime) {
+    Cube& cube = *particleSystem.getCubePointer(cubeIdx);
+    // springs are handled by the constraint projection and contact by projection after the solve, only gravity
+    // enters as a force
+    cube.addForceField(particleSystem.gravity);
+    ParticleStore& particles = cube.getParticles();
+    const SpringBatch& springs = cube.getSpringBatch();
+    const int n = particles.size();
+    const float h = deltaTime;
+    CubeState& state = states[cubeIdx];
+    Eigen::MatrixX3f& inertia = state.inertia;
+    Eigen::MatrixX3f& displacement = state.displacement;
+    Eigen::MatrixX3f& previousPosition = state.previousPosition;
+    Eigen::MatrixX3f& predictedPosition = state.predictedPosition;
+
+    if (state.factoredSprings != &springs || state.factoredRevision != springs.getRevision() ||
+        state.factoredDeltaTime != h || state.factoredParticleCount != n) {
+        factorize(cube, h, state);
+    }
+
+    // inertia = M (y - x_n) / h^2, the displacement starts at y - x_n
+    inertia.resize(n, 3);
+    displacement.resize(n, 3);
+    const float* mass = particles.massData();
+    const float* inverseMass = particles.inverseMassData();
+    for (int axis = 0; axis < 3; ++axis) {
+        const float* v = particles.velocityData(axis);
+        const float* f = particles.forceData(axis);
+        for (int i = 0; i < n; ++i) {
+            displacement(i, axis) = h * v[i] + h * h * inverseMass[i] * f[i];
+            inertia(i, axis) = mass[i] * displacement(i, axis) / (h * h);
+        }
+    }
+
+    for (int iteration = 0; iteration < iterations; ++iteration) {
+        project(cube, state);
+        assembleRightHandSide(cube, state);
+        state.solver.solve(state.rhs, displacement);
+    }
+
+    previousPosition.resize(n, 3);
+    predictedPosition.resize(n, 3);
+    for (int axis = 0; axis < 3; ++axis) {
+        float* x = particles.positionData(axis);
+        float* v = particles.velocityData(axis);
+        for (int i = 0; i < n; ++i) {
+            previousPosition(i, axis) = x[i];
+            v[i] = displacement(i, axis) / h;
+            x[i] += displacement(i, axis);
+            predictedPosition(i, axis) = x[i];
+        }
+    }
+
+    // the local step reads x_n from the particles, contact is projected once the solve is written back
+    particleSystem.terrain->projectContact(previousPosition, cube);
+    for (int axis = 0; axis < 3; ++axis) {
+        const float* x = particles.positionData(axis);
+        float* v = particles.velocityData(axis);
+        for (int i = 0; i < n; ++i) v[i] += (x[i] - predictedPosition(i, axis)) / h;
+    }
+}
+
+void ProjectiveDynamicsIntegrator::factorize(const Cube& cube, const float deltaTime, CubeState& state) {
+    const ParticleStore& particles = cube.getParticles();
+    const SpringBatch& springs = cube.getSpringBatch();
+    const int n = particles.size();
+
+    std::vector<Eigen::Triplet<float>> entries;
+    entries.reserve(n + 4 * springs.size());
+    for (int i = 0; i < n; ++i) entries.emplace_back(i, i, particles.getMass(i) / (deltaTime * deltaTime));
+    for (int s = 0; s < springs.size(); ++s) {
+        const int a = springs.startData()[s];
+        const int b = springs.endData()[s];
+        const float weight = springs.springCoefData()[s] + springs.damperCoefData()[s] / deltaTime;
+        entries.emplace_back(a, a, weight);
+        entries.emplace_back(b, b, weight);
+        entries.emplace_back(a, b, -weight);
+        entries.emplace_back(b, a, -weight);
+    }
+    Eigen::SparseMatrix<float> system(n, n);
+    system.setFromTriplets(entries.begin(), entries.end());
+    state.solver.compute(system);
+
+    state.factoredSprings = &springs;
+    state.factoredRevision = springs.getRevision();
+    state.factoredDeltaTime = deltaTime;
+    state.factoredParticleCount = n;
+}
+
+void ProjectiveDynamicsIntegrator::project(const Cube& cube, CubeState& state) {
+    // springs per parallel chunk
+    constexpr int grain = 2048;
+    const ParticleStore& particles = cube.getParticles();
+    const SpringBatch& springs = cube.getSpringBatch();
+    const Eigen::MatrixX3f& displacement = state.displacement;
+    Eigen::MatrixX3f& projection = state.projection;
+    projection.resize(springs.size(), 3);
+    util::ThreadPool::getInstance().parallelFor(0, springs.size(), grain, [&](int begin, int end) {
+        for (int s = begin; s < end; ++s) {
+            const int a = springs.startData()[s];
+            const int b = springs.endData()[s];
+            // spring vector at the beginning of the step, G x_n
+            const Eigen::Vector3f initial = particles.getPosition(a) - particles.getPosition(b);
+            const Eigen::Vector3f delta = initial + (displacement.row(a) - displacement.row(b)).transpose();
+            const float length = delta.norm();
+            // a degenerate spring keeps its current vector
+            const Eigen::Vector3f target = length > 0.0f ? (springs.restLengthData()[s] / length) * delta : delta;
+            projection.row(s) = springs.springCoefData()[s] * (target - initial);
+        }
+    });
+}
+
+void ProjectiveDynamicsIntegrator::assembleRightHandSide(const Cube& cube, CubeState& state) {
+    // particles per parallel chunk
+    constexpr int grain = 128;
+    const Eigen::MatrixX3f& inertia = state.inertia;
+    const Eigen::MatrixX3f& projection = state.projection;
+    Eigen::MatrixX3f& rhs = state.rhs;
+    const SpringBatch& springs = cube.getSpringBatch();
+    const int* offsets = springs.incidentOffsetData();
+    const int* incident = springs.incidentSpringData();
+    rhs.resize(inertia.rows(), 3);
+    util::ThreadPool::getInstance().parallelFor(0, static_cast<int>(inertia.rows()), grain, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            Eigen::RowVector3f sum = inertia.row(i);
+            for (int entry = offsets[i]; entry < offsets[i + 1]; ++entry) {
+                const int s = incident[entry] >> 1;
+                // G^T adds a spring's vector to its start particle and subtracts it from its end particle
+                if (incident[entry] & 1) {
+                    sum -= projection.row(s);
+                } else {
+                    sum += projection.row(s);
+                }
+            }
+            rhs.row(i) = sum;
+        }
+    });
+}
+
+//
+// XPBDIntegrator
+//
+
+IntegratorType XPBDIntegrator::getType() { return IntegratorType::XPBD; }
+
+void XPBDIntegrator::reserveCubes(const int cubeCount) {
+    Integrator::reserveCubes(cubeCount);
+    if (static_cast<int>(states.size()) < cubeCount) states.resize(cubeCount);
+}
+
+void XPBDIntegrator::integrateCube(MassSpringSystem& particleSystem, const int cubeIdx, const float deltaTime) {
+    // springs per parallel chunk, small colors are solved by the calling thread alone
+    constexpr int grain = 2048;
+    Cube& cube = *particleSystem.getCubePointer(cubeIdx);
+    ParticleStore& particles = cube.getParticles();
+    const int n = particles.size();
+    const float h = deltaTime;
+    CubeState& state = states[cubeIdx];
+    Eigen::MatrixX3f& previousPosition = state.previousPosition;
+    Eigen::MatrixX3f& predictedPosition = state.predictedPosition;
+
+    // contact is resolved by projection below, only gravity enters as a force
+    cube.addForceField(particleSystem.gravity);
+    previousPosition.resize(n, 3);
+    predictedPosition.resize(n, 3);
+    const float* inverseMass = particles.inverseMassData();
+    for (int axis = 0; axis < 3; ++axis) {
+        float* position = particles.positionData(axis);
+        float* velocity = particles.velocityData(axis);
+        const float* force = particles.forceData(axis);
+        for (int i = 0; i < n; ++i) {
+            previousPosition(i, axis) = position[i];
+            velocity[i] += force[i] * inverseMass[i] * h;
+            position[i] += velocity[i] * h;
+            predictedPosition(i, axis) = position[i];
+        }
+    }
+
+    state.lambda.assign(cube.getSpringBatch().size(), 0.0f);
+    util::ThreadPool& pool = util::ThreadPool::getInstance();
+    for (int iteration = 0; iteration < iterations; ++iteration) {
+        for (int color = 0; color < cube.getSpringColorCount(); ++color) {
+            pool.parallelFor(cube.getSpringColorBegin(color), cube.getSpringColorBegin(color + 1), grain,
+                             [&](int begin, int end) { solveSprings(begin, end, h, cube, state); });
+        }
+        particleSystem.terrain->projectContact(previousPosition, cube);
+    }
+
+    // v = (x - x_n) / h, written as the predicted velocity plus the correction so that unconstrained particles keep
+    // their velocity exactly instead of the rounding error of x + h v
+    for (int axis = 0; axis < 3; ++axis) {
+        const float* position = particles.positionData(axis);
+        float* velocity = particles.velocityData(axis);
+        for (int i = 0; i < n; ++i) velocity[i] += (position[i] - predictedPosition(i, axis)) / h;
+    }
+}
+
+void XPBDIntegrator::solveSprings(const int begin, const int end, const float deltaTime, Cube& cube,
+                                  CubeState& state) {
+    const Eigen::MatrixX3f& previousPosition = state.previousPosition;
+    float* lambda = state.lambda.data();
+    ParticleStore& particles = cube.getParticles();
+    const SpringBatch& springs = cube.getSpringBatch();
+    const float* inverseMass = particles.inverseMassData();
+    for (int s = begin; s < end; ++s) {
+        const int a = springs.startData()[s];
+        const int b = springs.endData()[s];
+        const Eigen::Vector3f delta = particles.getPosition(a) - particles.getPosition(b);
+        const float length = delta.norm();
+        if (length == 0.0f) continue;
+        const Eigen::Vector3f gradient = delta / length;
+        const Eigen::Vector3f motion =
+            (particles.getPosition(a) - previousPosition.row(a).transpose()) -
+            (particles.getPosition(b) - previousPosition.row(b).transpose());
+
+        // Compliance alpha / h^2 with alpha = 1 / k, damping gamma = alpha * beta / h with beta = h^2 * d. The
+        // update (-C - alpha / h^2 lambda - gamma grad C . motion) / ((1 + gamma) w + alpha / h^2) is multiplied
+        // through by k h^2, so a spring without stiffness is a pure damper instead of dividing by zero.
+        const float stiffness = springs.springCoefData()[s] * deltaTime * deltaTime;
+        const float damping = springs.damperCoefData()[s] * deltaTime;
+        const float weight = inverseMass[a] + inverseMass[b];
+        const float constraint = length - springs.restLengthData()[s];
+        const float deltaLambda = (-stiffness * constraint - lambda[s] - damping * gradient.dot(motion)) /
+                                  ((stiffness + damping) * weight + 1.0f);
+        lambda[s] += deltaLambda;
+        particles.addPosition(a, inverseMass[a] * deltaLambda * gradient);
+        particles.addPosition(b, -inverseMass[b] * deltaLambda * gradient);
+    }
+}
+
+//
+// DormandPrinceIntegrator
+//
+
+namespace {
+// Butcher tableau of Dormand-Prince 5(4). Row i of stageCoef builds stage i + 1 from the derivatives k1 ... k(i + 1),
+// the last row being the fifth order solution, errorCoef holds the difference to the embedded fourth order one.
+constexpr int dormandPrinceStages = 7;
+constexpr float stageTime[dormandPrinceStages] = {0.0f, 1.0f / 5, 3.0f / 10, 4.0f / 5, 8.0f / 9, 1.0f, 1.0f};
+constexpr float stageCoef[dormandPrinceStages - 1][dormandPrinceStages - 1] = {
+    {1.0f / 5},
+    {3.0f / 40, 9.0f / 40},
+    {44.0f / 45, -56.0f / 15, 32.0f / 9},
+    {19372.0f / 6561, -25360.0f / 2187, 64448.0f / 6561, -212.0f / 729},
+    {9017.0f / 3168, -355.0f / 33, 46732.0f / 5247, 49.0f / 176, -5103.0f / 18656},
+    {35.0f / 384, 0.0f, 500.0f / 1113, 125.0f / 192, -2187.0f / 6784, 11.0f / 84}};
+constexpr float errorCoef[dormandPrinceStages] = {71.0f / 57600,     0.0f,         -71.0f / 16695, 71.0f / 1920,
+                                                  -17253.0f / 339200, 22.0f / 525, -1.0f / 40};
+}  // namespace
+
+IntegratorType DormandPrinceIntegrator::getType() { return IntegratorType::DormandPrince; }
+
+float DormandPrinceIntegrator::getStepSize(const int cubeIdx) const {
+    return cubeIdx < static_cast<int>(states.size()) ? states[cubeIdx].stepSize : 0.0f;
+}
+
+void DormandPrinceIntegrator::reserveCubes(const int cubeCount) {
+    Integrator::reserveCubes(cubeCount);
+    if (static_cast<int>(states.size()) < cubeCount) states.resize(cubeCount);
+}
+
+void DormandPrinceIntegrator::integrateCube(MassSpringSystem& particleSystem, const int cubeIdx,
+                                            const float deltaTime) {
+    advanceCube<Terrain>(particleSystem, cubeIdx, deltaTime);
+}
+
+Integrator::CubeStepper DormandPrinceIntegrator::getCubeStepper(const TerrainType type) const {
+    return selectCubeStepper<DormandPrinceIntegrator>(type);
+}
+
+template <typename TerrainT>
+void DormandPrinceIntegrator::advanceCube(MassSpringSystem& particleSystem, const int cubeIdx,
+                                          const float deltaTime) {
+    Cube& cube = *particleSystem.getCubePointer(cubeIdx);
+    ParticleStore& particles = cube.getParticles();
+    float& stepSize = states[cubeIdx].stepSize;
+    float& budget = states[cubeIdx].budget;
+    if (stepSize <= 0.0f) stepSize = std::min(std::max(deltaTime, minStep), maxStep);
+    budget += deltaTime;
+    // workspace stage 0 holds the start state of a step, stage j + 1 the derivative k(j + 1) as (velocity,
+    // acceleration) in its position and velocity arrays
+    IntegratorWorkspace& workspace = workspaces[cubeIdx];
+    workspace.reserve(dormandPrinceStages + 1, particles);
+
+    bool evaluated = false;
+    while (budget >= stepSize) {
+        if (!evaluated) {
+            // the state may have been edited since the last call, evaluate k1 afresh
+            particleSystem.computeCubeForce<TerrainT>(cube, stepSize);
+            evaluated = true;
+        }
+        // particles hold the start state with its force evaluated, either fresh or as the last stage of the
+        // previous accepted step (first same as last)
+        workspace.save(particles, 0);
+        const float* inverseMass = particles.inverseMassData();
+        for (int axis = 0; axis < 3; ++axis) {
+            std::copy_n(particles.velocityData(axis), particles.paddedSize(), workspace.positionData(1, axis));
+            const float* force = particles.forceData(axis);
+            float* acceleration = workspace.velocityData(1, axis);
+            for (int i = 0; i < particles.paddedSize(); ++i) acceleration[i] = force[i] * inverseMass[i];
+        }
+
+        while (true) {
+            const float step = stepSize;
+            const float error = attemptStep<TerrainT>(particleSystem, cube, workspace, step);
+            // standard controller with safety factor 0.9, change the step by at most 5 times per step
+            const float factor = error > 0.0f ? 0.9f * std::pow(error, -0.2f) : 5.0f;
+            stepSize = std::min(std::max(step * std::min(std::max(factor, 0.2f), 5.0f), minStep), maxStep);
+            if (error <= 1.0f || step <= minStep) {
+                budget -= step;
+                break;
+            }
+            // rejected, retry from the start state, k1 is still valid
+            workspace.restore(0, particles);
+        }
+    }
+}
+
+template <typename TerrainT>
+float DormandPrinceIntegrator::attemptStep(MassSpringSystem& particleSystem, Cube& cube,
+                                           IntegratorWorkspace& workspace, const float h) const {
+    ParticleStore& particles = cube.getParticles();
+    const int n = particles.size();
+    const float* inverseMass = particles.inverseMassData();
+
+    for (int stage = 1; stage < dormandPrinceStages; ++stage) {
+        const float* coef = stageCoef[stage - 1];
+        for (int axis = 0; axis < 3; ++axis) {
+            float* position = particles.positionData(axis);
+            float* velocity = particles.velocityData(axis);
+            std::copy_n(workspace.positionData(0, axis), n, position);
+            std::copy_n(workspace.velocityData(0, axis), n, velocity);
+            for (int j = 0; j < stage; ++j) {
+                if (coef[j] == 0.0f) continue;
+                const float weight = h * coef[j];
+                const float* derivativePosition = workspace.positionData(j + 1, axis);
+                const float* derivativeVelocity = workspace.velocityData(j + 1, axis);
+                for (int i = 0; i < n; ++i) {
+                    position[i] += weight * derivativePosition[i];
+                    velocity[i] += weight * derivativeVelocity[i];
+                }
+            }
+        }
+        // collision handling of a stage covers the time elapsed since the start of the step
+        particleSystem.computeCubeForce<TerrainT>(cube, stageTime[stage] * h);
+        for (int axis = 0; axis < 3; ++axis) {
+            std::copy_n(particles.velocityData(axis), n, workspace.positionData(stage + 1, axis));
+            const float* force = particles.forceData(axis);
+            float* acceleration = workspace.velocityData(stage + 1, axis);
+            for (int i = 0; i < n; ++i) acceleration[i] = force[i] * inverseMass[i];
+        }
+    }
+
+    // the last stage was evaluated at the fifth order solution, which is left in the cube as its collision handling
+    // adjusted it
+    double sum = 0.0;
+    for (int axis = 0; axis < 3; ++axis) {
+        const float* startPosition = workspace.positionData(0, axis);
+        const float* startVelocity = workspace.velocityData(0, axis);
+        const float* position = particles.positionData(axis);
+        const float* velocity = particles.velocityData(axis);
+        for (int i = 0; i < n; ++i) {
+            float errorPosition = 0.0f, errorVelocity = 0.0f;
+            for (int j = 0; j < dormandPrinceStages; ++j) {
+                errorPosition += errorCoef[j] * workspace.positionData(j + 1, axis)[i];
+                errorVelocity += errorCoef[j] * workspace.velocityData(j + 1, axis)[i];
+            }
+            const float scalePosition =
+                absoluteTolerance + relativeTolerance * std::max(std::abs(startPosition[i]), std::abs(position[i]));
+            const float scaleVelocity =
+                absoluteTolerance + relativeTolerance * std::max(std::abs(startVelocity[i]), std::abs(velocity[i]));
+            sum += std::pow(h * errorPosition / scalePosition, 2) + std::pow(h * errorVelocity / scaleVelocity, 2);
+        }
     }
+    return static_cast<float>(std::sqrt(sum / (6.0 * n)));
 }
 }  // namespace simulation
@@ -0,0 +1,27 @@
+#include "integratorWorkspace.h"
+
+#include <algorithm>
+
+namespace simulation {
+void IntegratorWorkspace::reserve(const int stageCount, const ParticleStore &particles) {
+    stride = particles.paddedSize();
+    const size_t required = static_cast<size_t>(stageCount) * 6 * stride;
+    if (data.size() < required) data.resize(required);
+}
+
+void IntegratorWorkspace::save(const ParticleStore &particles, const int stage) {
+    for (int axis = 0; axis < 3; ++axis) {
+        std::copy_n(particles.positionData(axis), stride, positionData(stage, axis));
+        std::copy_n(particles.velocityData(axis), stride, velocityData(stage, axis));
+    }
+}
+
+void IntegratorWorkspace::restore(const int stage, ParticleStore &particles) {
+    for (int axis = 0; axis < 3; ++axis) {
+        std::copy_n(positionData(stage, axis), stride, particles.positionData(axis));
+        std::copy_n(velocityData(stage, axis), stride, particles.velocityData(axis));
+    }
+}
+
+void IntegratorWorkspace::clear(const int stage) { std::fill_n(positionData(stage, 0), 6 * stride, 0.0f); }
+}  // namespace simulation
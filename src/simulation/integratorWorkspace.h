@@ -0,0 +1,37 @@
+#pragma once
+#include <vector>
+
+#include "particleStore.h"
+
+namespace simulation {
+// Preallocated copies of the dynamic state (positions and velocities) of a cube, used by multi-stage integrators to
+// keep the state at the beginning of a step and to accumulate stage derivatives. Stages share one aligned block
+// that only grows, so once it is sized for a cube, stepping does not allocate.
+class IntegratorWorkspace {
+ public:
+    //==========================================
+    //  getter
+    //==========================================
+
+    // component arrays of a stage, axis is 0 / 1 / 2 for x / y / z
+    float *positionData(const int stage, const int axis) { return data.data() + (stage * 6 + axis) * stride; }
+    float *velocityData(const int stage, const int axis) { return data.data() + (stage * 6 + 3 + axis) * stride; }
+
+    //==========================================
+    //  method
+    //==========================================
+
+    // make room for stageCount stages of particles
+    void reserve(const int stageCount, const ParticleStore &particles);
+    // copy positions and velocities of particles into stage
+    void save(const ParticleStore &particles, const int stage);
+    // copy positions and velocities of stage back into particles
+    void restore(const int stage, ParticleStore &particles);
+    // set every position and velocity of stage to zero
+    void clear(const int stage);
+
+ private:
+    int stride = 0;  // floats per component, the padded particle count
+    ParticleStore::FloatArray data;
+};
+}  // namespace simulation
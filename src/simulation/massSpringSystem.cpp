@@ -1,14 +1,72 @@
 #include "massSpringSystem.h"
 
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
 #include <utility>
 
+#include "../util/mappedFile.h"
+#include "../util/threadPool.h"
 #include "integrator.h"
 namespace simulation {
 constexpr float g_cdDeltaT = 0.001f;
 constexpr float g_cdK = 2000.0f;
 constexpr float g_cdD = 60.0f;
+
+namespace {
+// Checkpoint layout, in the byte order of the machine that wrote it: a CheckpointHeader padded to dataOffset, then
+// for every cube its position, velocity, force and external force arrays, each of x, y and z and holding
+// paddedParticleCount floats. Every array starts on a 64 bytes boundary of the file, like those of ParticleStore,
+// so they are read straight out of a mapping of the file. Bump checkpointVersion on any change of the layout.
+constexpr char checkpointMagic[8] = "SOFTSIM";
+constexpr std::uint32_t checkpointVersion = 1;
+constexpr std::uint32_t checkpointByteOrder = 0x01020304;
+constexpr std::uint8_t checkpointNoTerrain = 0xFF;
+constexpr int checkpointArraysPerCube = 12;
+
+struct CheckpointHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byteOrder;
+    std::uint64_t dataOffset;  // bytes before the first array
+    std::int32_t cubeCount;
+    std::int32_t particleCountPerEdge;
+    std::int32_t paddedParticleCount;  // floats per array
+    std::uint8_t integratorType;
+    std::uint8_t terrainType;        // checkpointNoTerrain if none was set
+    std::uint8_t terrainSourceType;  // terrain sampled by an SDF terrain
+    std::uint8_t forceMode;
+    std::uint8_t isSelfColliding;
+    std::uint8_t reserved[3];
+    float deltaTime;
+    float springCoef[3];  // struct, shear and bending
+    float damperCoef[3];
+    float rotation;
+    float cubeLength;
+    float position[3];
+    float gravity[3];
+    float contactStiffness;
+    float contactDamping;
+    float contactFriction;
+};
+static_assert(std::is_trivially_copyable<CheckpointHeader>::value, "CheckpointHeader is copied as raw bytes");
+constexpr std::uint64_t checkpointDataOffset = (sizeof(CheckpointHeader) + 63) / 64 * 64;
+
+// call function on every array of particles in file order
+template <typename Store, typename Function>
+void forEachCheckpointArray(Store& particles, const Function& function) {
+    for (int axis = 0; axis < 3; ++axis) function(particles.positionData(axis));
+    for (int axis = 0; axis < 3; ++axis) function(particles.velocityData(axis));
+    for (int axis = 0; axis < 3; ++axis) function(particles.forceData(axis));
+    for (int axis = 0; axis < 3; ++axis) function(particles.externalForceData(axis));
+}
+}  // namespace
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Constructor & Destructor
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -19,8 +77,10 @@ MassSpringSystem::MassSpringSystem()
       isDrawingShear(false),
       isDrawingBending(false),
       isSimulating(false),
+      isSelfColliding(false),
 
       integratorType(IntegratorType::ExplicitEuler),
+      forceMode(ForceMode::Scatter),
       cubeCount(1),
       particleCountPerEdge(10),
       cubeID(1),
@@ -36,7 +96,10 @@ MassSpringSystem::MassSpringSystem()
       cubeLength(4.0),
 
       position(Eigen::Vector3f(0.0f, 5.0f, 0.0f)),
-      gravity(Eigen::Vector3f(0.0f, -9.8f, 0.0f)) {
+      gravity(Eigen::Vector3f(0.0f, -9.8f, 0.0f)),
+      contactStiffness(10.0f * g_cdK),
+      contactDamping(g_cdD),
+      contactFriction(0.5f) {
     initializeCube();
     reset();
 }
@@ -84,11 +147,30 @@ void MassSpringSystem::setDamperCoef(const float damperCoef, const Spring::Sprin
     }
 }
 
-void MassSpringSystem::setTerrain(std::unique_ptr<Terrain>&& terrain) { this->terrain = std::move(terrain); }
+void MassSpringSystem::setForceMode(const ForceMode mode) {
+    forceMode = mode;
+    for (int cubeIdx = 0; cubeIdx < cubeCount; cubeIdx++) {
+        cubes[cubeIdx].setForceMode(mode);
+    }
+}
+
+void MassSpringSystem::setCubeCount(const int count) {
+    if (count < 1) throw std::invalid_argument("MassSpringSystem::setCubeCount : count must be positive");
+    cubeCount = count;
+    cubes.clear();
+    initializeCube();
+    reset();
+}
+
+void MassSpringSystem::setTerrain(std::unique_ptr<Terrain>&& terrain) {
+    this->terrain = std::move(terrain);
+    if (this->integrator) this->integrator->bindTerrain(this->terrain->getType());
+}
 
 void MassSpringSystem::setIntegrator(std::unique_ptr<Integrator>&& integrator) {
     this->integrator = std::move(integrator);
     this->integratorType = this->integrator->getType();
+    if (this->terrain) this->integrator->bindTerrain(this->terrain->getType());
 }
 
 float MassSpringSystem::getSpringCoef(const Spring::SpringType springType) {
@@ -123,6 +205,149 @@ Cube* MassSpringSystem::getCubePointer(int n) {
     }
     return &cubes[n];
 }
+Terrain* MassSpringSystem::getTerrain() const { return terrain.get(); }
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Checkpoint
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void MassSpringSystem::saveCheckpoint(const util::fs::path& filePath) const {
+    CheckpointHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, checkpointMagic, sizeof(header.magic));
+    header.version = checkpointVersion;
+    header.byteOrder = checkpointByteOrder;
+    header.dataOffset = checkpointDataOffset;
+    header.cubeCount = cubeCount;
+    header.particleCountPerEdge = particleCountPerEdge;
+    header.paddedParticleCount = cubes[0].getParticles().paddedSize();
+    header.integratorType = static_cast<std::uint8_t>(integratorType);
+    header.terrainType = terrain ? static_cast<std::uint8_t>(terrain->getType()) : checkpointNoTerrain;
+    if (terrain && terrain->getType() == TerrainType::SDF) {
+        header.terrainSourceType = static_cast<std::uint8_t>(static_cast<const SDFTerrain&>(*terrain).getSourceType());
+    }
+    header.forceMode = static_cast<std::uint8_t>(forceMode);
+    header.isSelfColliding = isSelfColliding;
+    header.deltaTime = deltaTime;
+    header.springCoef[0] = springCoefStruct;
+    header.springCoef[1] = springCoefShear;
+    header.springCoef[2] = springCoefBending;
+    header.damperCoef[0] = damperCoefStruct;
+    header.damperCoef[1] = damperCoefShear;
+    header.damperCoef[2] = damperCoefBending;
+    header.rotation = rotation;
+    header.cubeLength = cubeLength;
+    for (int axis = 0; axis < 3; ++axis) {
+        header.position[axis] = position[axis];
+        header.gravity[axis] = gravity[axis];
+    }
+    header.contactStiffness = contactStiffness;
+    header.contactDamping = contactDamping;
+    header.contactFriction = contactFriction;
+
+    // a crash while writing leaves the previous checkpoint intact
+    util::fs::path temporaryPath = filePath;
+    temporaryPath += ".tmp";
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        if (!file) throw std::runtime_error("MassSpringSystem::saveCheckpoint : cannot open " + temporaryPath.string());
+        const char padding[checkpointDataOffset - sizeof(CheckpointHeader)] = {};
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(padding, sizeof(padding));
+        const std::streamsize arrayBytes = sizeof(float) * header.paddedParticleCount;
+        for (const Cube& cube : cubes) {
+            forEachCheckpointArray(cube.getParticles(), [&file, arrayBytes](const float* data) {
+                file.write(reinterpret_cast<const char*>(data), arrayBytes);
+            });
+        }
+        file.close();
+        if (!file) {
+            util::fs::remove(temporaryPath);
+            throw std::runtime_error("MassSpringSystem::saveCheckpoint : cannot write " + temporaryPath.string());
+        }
+    }
+    util::fs::rename(temporaryPath, filePath);
+}
+
+void MassSpringSystem::loadCheckpoint(const util::fs::path& filePath) {
+    const util::MappedFile file(filePath);
+    const auto fail = [&filePath](const std::string& reason) {
+        throw std::runtime_error("MassSpringSystem::loadCheckpoint : " + filePath.string() + " " + reason);
+    };
+    CheckpointHeader header;
+    if (file.size() < sizeof(header)) fail("is not a checkpoint");
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, checkpointMagic, sizeof(header.magic)) != 0) fail("is not a checkpoint");
+    if (header.byteOrder != checkpointByteOrder) fail("was written with another byte order");
+    if (header.version != checkpointVersion) {
+        fail("has version " + std::to_string(header.version) + ", expected " + std::to_string(checkpointVersion));
+    }
+    const auto isTerrainType = [](const std::uint8_t type) {
+        return type <= static_cast<std::uint8_t>(TerrainType::Heightfield);
+    };
+    const bool isSDF = header.terrainType == static_cast<std::uint8_t>(TerrainType::SDF);
+    if (header.integratorType > static_cast<std::uint8_t>(IntegratorType::DormandPrince) ||
+        header.forceMode > static_cast<std::uint8_t>(ForceMode::Gather) ||
+        !(isTerrainType(header.terrainType) || header.terrainType == checkpointNoTerrain) ||
+        (isSDF && (!isTerrainType(header.terrainSourceType) ||
+                   header.terrainSourceType == static_cast<std::uint8_t>(TerrainType::SDF)))) {
+        fail("has an invalid type");
+    }
+    if (header.cubeCount < 1 || header.particleCountPerEdge < 2 || header.particleCountPerEdge > 1024) {
+        fail("has an invalid size");
+    }
+    const int particleCount = header.particleCountPerEdge * header.particleCountPerEdge * header.particleCountPerEdge;
+    constexpr int lane = ParticleStore::lane;
+    const int paddedParticleCount = (particleCount + lane - 1) / lane * lane;
+    if (header.paddedParticleCount != paddedParticleCount || header.dataOffset % 64 != 0 ||
+        header.dataOffset < sizeof(header) || header.dataOffset > file.size()) {
+        fail("has an invalid layout");
+    }
+    const std::uint64_t arrayBytes = sizeof(float) * static_cast<std::uint64_t>(header.paddedParticleCount);
+    if (file.size() != header.dataOffset + arrayBytes * checkpointArraysPerCube * header.cubeCount) {
+        fail("is truncated");
+    }
+
+    // everything that may throw comes before the system changes, a checkpoint saved without terrain keeps the
+    // current one
+    std::unique_ptr<Terrain> newTerrain;
+    if (isSDF) {
+        newTerrain = TerrainFactory::CreateSDFTerrain(static_cast<TerrainType>(header.terrainSourceType));
+    } else if (header.terrainType != checkpointNoTerrain) {
+        newTerrain = TerrainFactory::CreateTerrain(static_cast<TerrainType>(header.terrainType));
+    }
+    std::unique_ptr<Integrator> newIntegrator =
+        IntegratorFactory::CreateIntegrator(static_cast<IntegratorType>(header.integratorType));
+
+    particleCountPerEdge = header.particleCountPerEdge;
+    forceMode = static_cast<ForceMode>(header.forceMode);
+    isSelfColliding = header.isSelfColliding != 0;
+    deltaTime = header.deltaTime;
+    springCoefStruct = header.springCoef[0];
+    springCoefShear = header.springCoef[1];
+    springCoefBending = header.springCoef[2];
+    damperCoefStruct = header.damperCoef[0];
+    damperCoefShear = header.damperCoef[1];
+    damperCoefBending = header.damperCoef[2];
+    rotation = header.rotation;
+    cubeLength = header.cubeLength;
+    position = Eigen::Vector3f(header.position[0], header.position[1], header.position[2]);
+    gravity = Eigen::Vector3f(header.gravity[0], header.gravity[1], header.gravity[2]);
+    contactStiffness = header.contactStiffness;
+    contactDamping = header.contactDamping;
+    contactFriction = header.contactFriction;
+    // rebuilds the springs and surface hierarchies with the parameters above
+    setCubeCount(header.cubeCount);
+
+    const unsigned char* data = file.data() + header.dataOffset;
+    for (Cube& cube : cubes) {
+        forEachCheckpointArray(cube.getParticles(), [&data, arrayBytes](float* array) {
+            std::memcpy(array, data, arrayBytes);
+            data += arrayBytes;
+        });
+    }
+
+    setIntegrator(std::move(newIntegrator));
+    if (newTerrain) setTerrain(std::move(newTerrain));
+}
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Simulation Part
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -138,6 +363,16 @@ bool MassSpringSystem::checkStable() {
             if (std::isnan(vel) || vel > 1e6) return false;
         }
     }
+    // a cube that passed through the terrain falls at a bounded speed, only its depth gives it away
+    if (terrain) {
+        const float tunnelDepth = 0.5f * cubeLength;
+        for (int cubeIdx = 0; cubeIdx < cubeCount; cubeIdx++) {
+            const ParticleStore& particles = cubes[cubeIdx].getParticles();
+            for (int i = 0; i < particles.size(); ++i) {
+                if (terrain->signedDistance(particles.getPosition(i)) < -tunnelDepth) return false;
+            }
+        }
+    }
     return true;
 }
 
@@ -151,34 +386,199 @@ void MassSpringSystem::simulationOneTimeStep() {
 // Initialization
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 void MassSpringSystem::initializeCube() {
+    cubes.reserve(cubeCount);
     for (int cubeIdx = 0; cubeIdx < cubeCount; cubeIdx++) {
-        Cube NewCube(Eigen::Vector3f(0.0f, cubeLength, 0.0f - (2.0f * cubeLength * cubeIdx)), cubeLength,
+        Cube NewCube(Eigen::Vector3f(0.0f, cubeLength, 0.0f) + getCubeOffset(cubeIdx), cubeLength,
                      particleCountPerEdge, springCoefStruct, damperCoefStruct);
+        NewCube.setSpringCoef(springCoefShear, Spring::SpringType::SHEAR);
+        NewCube.setSpringCoef(springCoefBending, Spring::SpringType::BENDING);
+        NewCube.setDamperCoef(damperCoefShear, Spring::SpringType::SHEAR);
+        NewCube.setDamperCoef(damperCoefBending, Spring::SpringType::BENDING);
+        NewCube.setForceMode(forceMode);
         cubes.push_back(NewCube);
     }
+    surfaceBVHs.resize(cubeCount);
+    selfContactFlags.resize(cubeCount);
+    for (int cubeIdx = 0; cubeIdx < cubeCount; cubeIdx++) {
+        const std::vector<int>& triangles = cubes[cubeIdx].getSurfaceTriangles();
+        surfaceBVHs[cubeIdx].build(triangles.data(), static_cast<int>(triangles.size()) / 3,
+                                   cubes[cubeIdx].getParticles());
+        selfContactFlags[cubeIdx].assign(cubes[cubeIdx].getSurfaceParticles().size(), 0);
+    }
+}
+
+Eigen::Vector3f MassSpringSystem::getCubeOffset(const int cubeIdx) const {
+    const int side = static_cast<int>(std::ceil(std::sqrt(static_cast<float>(cubeCount))));
+    return Eigen::Vector3f(2.0f * cubeLength * (cubeIdx % side), 0.0f, -2.0f * cubeLength * (cubeIdx / side));
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Compute Force
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-void MassSpringSystem::computeAllForce() {
+void MassSpringSystem::computeCubeContact() {
+    // surface particles per parallel chunk of the response
+    constexpr int grain = 256;
+    auto& pool = util::ThreadPool::getInstance();
+
+    // 1. gather the surface particles of every cube
+    contactOffsets.resize(cubeCount + 1);
+    contactOffsets[0] = 0;
     for (int cubeIdx = 0; cubeIdx < cubeCount; cubeIdx++) {
-        computeCubeForce(cubes[cubeIdx]);
+        contactOffsets[cubeIdx + 1] =
+            contactOffsets[cubeIdx] + static_cast<int>(cubes[cubeIdx].getSurfaceParticles().size());
+    }
+    const int contactCount = contactOffsets[cubeCount];
+    if (contactParticles.size() != contactCount) {
+        contactParticles.resize(contactCount);
+        contactCubeIDs.resize(contactCount);
+        contactParticleIDs.resize(contactCount);
     }
+    pool.parallelFor(0, cubeCount, 1, [this](const int begin, const int end) {
+        for (int cubeIdx = begin; cubeIdx < end; cubeIdx++) {
+            const ParticleStore& particles = cubes[cubeIdx].getParticles();
+            const std::vector<int>& surface = cubes[cubeIdx].getSurfaceParticles();
+            for (int i = 0; i < static_cast<int>(surface.size()); i++) {
+                const int contactIdx = contactOffsets[cubeIdx] + i;
+                contactParticles.setPosition(contactIdx, particles.getPosition(surface[i]));
+                contactParticles.setVelocity(contactIdx, particles.getVelocity(surface[i]));
+                contactCubeIDs[contactIdx] = cubeIdx;
+                contactParticleIDs[contactIdx] = surface[i];
+            }
+        }
+    });
+
+    // 2. broad phase, a cell as wide as the contact radius holds every candidate in its 3x3x3 neighborhood
+    const float radius = cubeLength / (particleCountPerEdge - 1);
+    contactHash.build(contactParticles.positionData(0), contactParticles.positionData(1),
+                      contactParticles.positionData(2), contactCount, radius);
+
+    // 3. penalty response, every surface particle only writes its own external force
+    pool.parallelFor(0, contactCount, grain, [this, radius](const int begin, const int end) {
+        int buckets[SpatialHash::maxNeighborBuckets];
+        const int* candidates = contactHash.getPointData();
+        for (int i = begin; i < end; i++) {
+            const Eigen::Vector3f position = contactParticles.getPosition(i);
+            const Eigen::Vector3f velocity = contactParticles.getVelocity(i);
+            Eigen::Vector3f force = Eigen::Vector3f::Zero();
+            const int bucketCount = contactHash.getNeighborBuckets(position[0], position[1], position[2], buckets);
+            for (int b = 0; b < bucketCount; b++) {
+                const int last = contactHash.getBucketBegin(buckets[b] + 1);
+                for (int entry = contactHash.getBucketBegin(buckets[b]); entry < last; entry++) {
+                    const int j = candidates[entry];
+                    if (contactCubeIDs[j] == contactCubeIDs[i]) continue;
+                    const Eigen::Vector3f delta = position - contactParticles.getPosition(j);
+                    const float distanceSquared = delta.squaredNorm();
+                    if (distanceSquared >= radius * radius || distanceSquared == 0.0f) continue;
+                    const float distance = std::sqrt(distanceSquared);
+                    const Eigen::Vector3f normal = delta / distance;
+                    const Eigen::Vector3f relativeVelocity = velocity - contactParticles.getVelocity(j);
+                    const float approach = relativeVelocity.dot(normal);
+                    // no adhesion, damping may only cancel part of the repulsion
+                    const float magnitude = contactStiffness * (radius - distance) - contactDamping * approach;
+                    if (magnitude <= 0.0f) continue;
+                    force += magnitude * normal;
+                    // viscous friction opposing the sliding velocity, capped by the Coulomb cone
+                    const Eigen::Vector3f slip = relativeVelocity - approach * normal;
+                    const float slipSpeed = slip.norm();
+                    if (slipSpeed > 0.0f) {
+                        const float friction = std::min(contactDamping * slipSpeed, contactFriction * magnitude);
+                        force -= friction / slipSpeed * slip;
+                    }
+                }
+            }
+            cubes[contactCubeIDs[i]].getParticles().addExternalForce(contactParticleIDs[i], force);
+        }
+    });
 }
 
-void MassSpringSystem::computeCubeForce(Cube& cube) {
-    cube.addForceField(gravity);
-    cube.computeInternalForce();
-    // delegate to terrain to handle collision
-    terrain->handleCollision(deltaTime, cube);
+void MassSpringSystem::computeSelfContact() {
+    // surface particles per parallel chunk of the queries
+    constexpr int grain = 64;
+    auto& pool = util::ThreadPool::getInstance();
+    const float spacing = cubeLength / (particleCountPerEdge - 1);
+    // half the spacing, no pair outside a neighborhood is that close at rest
+    const float thickness = 0.5f * spacing;
+    const int edge = particleCountPerEdge;
+
+    // call visit(vertex, weights, force) for every triangle in contact with particle i, force acting on i and
+    // weights being the barycentric weights of the closest point of the triangle
+    const auto forEachContact = [&](const ParticleStore& particles, const TriangleBVH& bvh, const int i,
+                                    const auto& visit) {
+        const Eigen::Vector3f position = particles.getPosition(i);
+        const Eigen::Vector3f velocity = particles.getVelocity(i);
+        bvh.query(position, [&](const int t) {
+            const int* vertex = bvh.getTriangle(t);
+            for (int v = 0; v < 3; v++) {
+                // squared distance of the rest lattice positions
+                const int di = i / (edge * edge) - vertex[v] / (edge * edge);
+                const int dj = (i / edge) % edge - (vertex[v] / edge) % edge;
+                const int dk = i % edge - vertex[v] % edge;
+                if (di * di + dj * dj + dk * dk <= 2) return;
+            }
+            const Eigen::Vector3f a = particles.getPosition(vertex[0]);
+            const Eigen::Vector3f b = particles.getPosition(vertex[1]);
+            const Eigen::Vector3f c = particles.getPosition(vertex[2]);
+            const Eigen::Vector3f weights = closestPointWeights(position, a, b, c);
+            const Eigen::Vector3f delta = position - (weights[0] * a + weights[1] * b + weights[2] * c);
+            const float distanceSquared = delta.squaredNorm();
+            if (distanceSquared >= thickness * thickness || distanceSquared == 0.0f) return;
+            const float distance = std::sqrt(distanceSquared);
+            const Eigen::Vector3f normal = delta / distance;
+            const Eigen::Vector3f triangleVelocity = weights[0] * particles.getVelocity(vertex[0]) +
+                                                     weights[1] * particles.getVelocity(vertex[1]) +
+                                                     weights[2] * particles.getVelocity(vertex[2]);
+            const float approach = (velocity - triangleVelocity).dot(normal);
+            const float magnitude = contactStiffness * (thickness - distance) - contactDamping * approach;
+            if (magnitude > 0.0f) visit(vertex, weights, Eigen::Vector3f(magnitude * normal));
+        });
+    };
+
+    pool.parallelFor(0, cubeCount, 1, [&](const int begin, const int end) {
+        for (int cubeIdx = begin; cubeIdx < end; cubeIdx++) {
+            ParticleStore& particles = cubes[cubeIdx].getParticles();
+            const TriangleBVH& bvh = surfaceBVHs[cubeIdx];
+            surfaceBVHs[cubeIdx].refit(particles, thickness);
+            const std::vector<int>& surface = cubes[cubeIdx].getSurfaceParticles();
+            std::vector<unsigned char>& isTouching = selfContactFlags[cubeIdx];
+            // every surface particle only writes its own external force
+            pool.parallelFor(0, static_cast<int>(surface.size()), grain, [&](const int first, const int last) {
+                for (int s = first; s < last; s++) {
+                    Eigen::Vector3f force = Eigen::Vector3f::Zero();
+                    isTouching[s] = 0;
+                    const auto accumulate = [&](const int*, const Eigen::Vector3f&,
+                                                const Eigen::Vector3f& contactForce) {
+                        force += contactForce;
+                        isTouching[s] = 1;
+                    };
+                    forEachContact(particles, bvh, surface[s], accumulate);
+                    particles.addExternalForce(surface[s], force);
+                }
+            });
+            // The reaction goes to the triangle's vertices by the weights of the contact point. Vertices are shared
+            // between contacts, so it is added serially, revisiting only the particles that touched.
+            const auto react = [&particles](const int* vertex, const Eigen::Vector3f& weights,
+                                            const Eigen::Vector3f& contactForce) {
+                for (int v = 0; v < 3; v++) particles.addExternalForce(vertex[v], -weights[v] * contactForce);
+            };
+            for (int s = 0; s < static_cast<int>(surface.size()); s++) {
+                if (isTouching[s]) forEachContact(particles, bvh, surface[s], react);
+            }
+        }
+    });
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Integrator
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 void MassSpringSystem::integrate() {
-    computeAllForce();
+    // contact forces are rebuilt every step
+    for (int cubeIdx = 0; cubeIdx < cubeCount; cubeIdx++) {
+        cubes[cubeIdx].getParticles().clearExternalForce();
+    }
+    // a lone cube has nothing else to collide with
+    if (cubeCount > 1) computeCubeContact();
+    if (isSelfColliding) computeSelfContact();
+    // integrators evaluate the forces they need themselves
     integrator->integrate(*this);
 }
 }  // namespace simulation
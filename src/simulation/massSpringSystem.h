@@ -5,8 +5,12 @@
 
 #include "Eigen/Dense"
 
+#include "../util/filesystem.h"
 #include "cube.h"
+#include "particleStore.h"
+#include "spatialHash.h"
 #include "terrain.h"
+#include "triangleBVH.h"
 
 namespace simulation {
 // forward declaration to avoid circular include
@@ -21,9 +25,11 @@ class MassSpringSystem {
     bool isDrawingStruct;  // struct stands for structural
     bool isDrawingShear;
     bool isDrawingBending;
-    bool isSimulating;  // start or pause
+    bool isSimulating;     // start or pause
+    bool isSelfColliding;  // keep the faces of every cube from passing through each other
 
     IntegratorType integratorType;
+    ForceMode forceMode;       // how cubes evaluate their springs
     int cubeCount;             // number of cubes
     int particleCountPerEdge;  // number of particles at cube's edge
     int cubeID;                // ID of the cube under control (offset of rotation)
@@ -41,6 +47,9 @@ class MassSpringSystem {
 
     Eigen::Vector3f position;
     Eigen::Vector3f gravity;  // external force field
+    float contactStiffness;   // penalty stiffness between surface particles of different cubes
+    float contactDamping;     // damping of the relative velocity during contact
+    float contactFriction;    // Coulomb coefficient bounding the tangential contact force
 
     std::vector<Cube> cubes;
 
@@ -55,12 +64,17 @@ class MassSpringSystem {
     float getDamperCoef(const Spring::SpringType springType);
     int getCubeCount() const;
     Cube* getCubePointer(int n);
+    // nullptr until setTerrain
+    Terrain* getTerrain() const;
     //==========================================
     //  setter
     //==========================================
 
     void setSpringCoef(const float springCoef, const Spring::SpringType springType);
     void setDamperCoef(const float damperCoef, const Spring::SpringType springType);
+    void setForceMode(const ForceMode mode);
+    // rebuild the system with count cubes laid out on a square grid, then reset them
+    void setCubeCount(const int count);
 
     void setTerrain(std::unique_ptr<Terrain>&& terrain);
     void setIntegrator(std::unique_ptr<Integrator>&& integrator);
@@ -69,12 +83,22 @@ class MassSpringSystem {
     //  method
     //==========================================
 
+    // false once a velocity blew up or a particle lies deeper than half a cube inside the terrain
     bool checkStable();
 
     void simulationOneTimeStep();
 
     void reset();
 
+    // Write every cube's particle state, the parameters and the integrator and terrain types to filePath, which is
+    // replaced only once the whole file is written. Throws std::runtime_error if it cannot be written.
+    void saveCheckpoint(const util::fs::path& filePath) const;
+    // Restore a state written by saveCheckpoint, memory mapping the file and copying the particle arrays straight
+    // out of the mapping. Integrator internals (adaptive step size, constraint multipliers, factorizations) start
+    // over. A checkpoint saved without terrain keeps the current terrain. Throws std::runtime_error if filePath is not
+    // a checkpoint of this version and byte order.
+    void loadCheckpoint(const util::fs::path& filePath);
+
  private:
     // used for delegating part of the simulation process to other classes, in
     // this case : collision detection to terrain, and integration to
@@ -82,14 +106,45 @@ class MassSpringSystem {
     std::shared_ptr<Terrain> terrain;
     std::unique_ptr<Integrator> integrator;
 
+    // surface particles of every cube gathered for contact, those of cube c are [contactOffsets[c],
+    // contactOffsets[c + 1])
+    ParticleStore contactParticles;
+    std::vector<int> contactOffsets;
+    std::vector<int> contactCubeIDs;
+    std::vector<int> contactParticleIDs;
+    SpatialHash contactHash;
+    // hierarchy over the surface triangles of every cube, built with the cubes and refitted every step
+    std::vector<TriangleBVH> surfaceBVHs;
+    // per surface particle of every cube, whether it touched a triangle of its own cube in the last step
+    std::vector<std::vector<unsigned char>> selfContactFlags;
+
     //==========================================
     //  internal method
     //==========================================
 
     void initializeCube();
-
-    void computeAllForce();             // compute force of whole systems
-    void computeCubeForce(Cube& cube);  // compute force of one cube
+    // offset of cube idx from position, cubes fill a square grid on the xz plane row by row
+    Eigen::Vector3f getCubeOffset(const int cubeIdx) const;
+
+    // Penalty forces between cubes, stored as the particles' external forces and held over the step.
+    // Surface particles of different cubes closer than the particle spacing push each other apart and resist
+    // sliding. Candidates come from a spatial hash rebuilt over every surface particle, so the cost is linear in
+    // the particle count.
+    void computeCubeContact();
+    // Penalty forces between surface particles and the surface triangles of their own cube, added to the external
+    // forces, the equal and opposite force going to the triangle's vertices by barycentric weights. Triangles with a
+    // vertex at most one lattice step away from the particle at rest, diagonals of a face included, are its
+    // neighborhood and never collide.
+    void computeSelfContact();
+    // Compute force of one cube, collision handling covers deltaTime. The terrain must be a TerrainT, a final
+    // terrain class is called without virtual dispatch while Terrain itself dispatches at run time.
+    template <typename TerrainT = Terrain>
+    void computeCubeForce(Cube& cube, const float deltaTime) {
+        cube.addForceField(gravity);
+        cube.computeInternalForce();
+        // delegate to terrain to handle collision
+        static_cast<TerrainT&>(*terrain).handleCollision(deltaTime, cube);
+    }
 
     void integrate();
 
@@ -98,5 +153,9 @@ class MassSpringSystem {
     friend class ImplicitEulerIntegrator;
     friend class MidpointEulerIntegrator;
     friend class RungeKuttaFourthIntegrator;
+    friend class BackwardEulerIntegrator;
+    friend class ProjectiveDynamicsIntegrator;
+    friend class XPBDIntegrator;
+    friend class DormandPrinceIntegrator;
 };
 }  // namespace simulation
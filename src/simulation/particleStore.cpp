@@ -0,0 +1,57 @@
+#include "particleStore.h"
+
+#include <algorithm>
+
+namespace simulation {
+ParticleStore::ParticleStore(const int count) { resize(count); }
+
+//==========================================
+//  getter
+//==========================================
+
+Particle ParticleStore::getParticle(const int i) const {
+    Particle particle;
+    particle.setMass(mass[i]);
+    particle.setPosition(getPosition(i));
+    particle.setVelocity(getVelocity(i));
+    particle.setForce(getForce(i));
+    return particle;
+}
+
+//==========================================
+//  setter
+//==========================================
+
+void ParticleStore::setMass(const int i, const float _mass) {
+    mass[i] = _mass;
+    inverseMass[i] = 1.0f / _mass;
+}
+
+void ParticleStore::setParticle(const int i, const Particle &particle) {
+    setMass(i, particle.getMass());
+    setPosition(i, particle.getPosition());
+    setVelocity(i, particle.getVelocity());
+    setForce(i, particle.getForce());
+}
+
+//==========================================
+//  method
+//==========================================
+
+void ParticleStore::clearExternalForce() {
+    for (int axis = 0; axis < 3; ++axis) std::fill(externalForce[axis].begin(), externalForce[axis].end(), 0.0f);
+}
+
+void ParticleStore::resize(const int _count) {
+    count = _count;
+    const int padded = (count + lane - 1) / lane * lane;
+    for (int axis = 0; axis < 3; ++axis) {
+        position[axis].resize(padded, 0.0f);
+        velocity[axis].resize(padded, 0.0f);
+        force[axis].resize(padded, 0.0f);
+        externalForce[axis].resize(padded, 0.0f);
+    }
+    mass.resize(padded, 1.0f);
+    inverseMass.resize(padded, 1.0f);
+}
+}  // namespace simulation
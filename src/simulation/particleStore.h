@@ -0,0 +1,102 @@
+#pragma once
+#include <array>
+#include <vector>
+
+#include "Eigen/Dense"
+
+#include "../util/alignedAllocator.h"
+#include "particle.h"
+
+namespace simulation {
+// Structure-of-arrays particle storage.
+// Every component (x / y / z of position, velocity and force, plus mass) lives in its own contiguous, cache line
+// aligned array. Arrays are padded to a multiple of `lane` floats so vector kernels may load whole registers past
+// size() without reading out of bounds; padding particles have unit mass and stay at rest.
+// External forces are exerted by other bodies, they are computed once per time step and held over all of its
+// stages, Cube::addForceField adds them on top of the force field.
+class ParticleStore {
+ public:
+    using FloatArray = std::vector<float, util::AlignedAllocator<float>>;
+    // number of floats in one 64 bytes cache line
+    static constexpr int lane = 16;
+
+    ParticleStore() = default;
+    explicit ParticleStore(const int count);
+
+    //==========================================
+    //  getter
+    //==========================================
+
+    int size() const { return count; }
+    int paddedSize() const { return static_cast<int>(mass.size()); }
+
+    // raw component arrays, axis is 0 / 1 / 2 for x / y / z
+    float *positionData(const int axis) { return position[axis].data(); }
+    float *velocityData(const int axis) { return velocity[axis].data(); }
+    float *forceData(const int axis) { return force[axis].data(); }
+    float *externalForceData(const int axis) { return externalForce[axis].data(); }
+    float *massData() { return mass.data(); }
+    float *inverseMassData() { return inverseMass.data(); }
+    const float *positionData(const int axis) const { return position[axis].data(); }
+    const float *velocityData(const int axis) const { return velocity[axis].data(); }
+    const float *forceData(const int axis) const { return force[axis].data(); }
+    const float *externalForceData(const int axis) const { return externalForce[axis].data(); }
+    const float *massData() const { return mass.data(); }
+    const float *inverseMassData() const { return inverseMass.data(); }
+
+    float getMass(const int i) const { return mass[i]; }
+    Eigen::Vector3f getPosition(const int i) const { return {position[0][i], position[1][i], position[2][i]}; }
+    Eigen::Vector3f getVelocity(const int i) const { return {velocity[0][i], velocity[1][i], velocity[2][i]}; }
+    Eigen::Vector3f getForce(const int i) const { return {force[0][i], force[1][i], force[2][i]}; }
+    Eigen::Vector3f getExternalForce(const int i) const {
+        return {externalForce[0][i], externalForce[1][i], externalForce[2][i]};
+    }
+    Eigen::Vector3f getAcceleration(const int i) const { return getForce(i) * inverseMass[i]; }
+    // gather one particle into the array-of-structures representation
+    Particle getParticle(const int i) const;
+
+    //==========================================
+    //  setter
+    //==========================================
+
+    void setMass(const int i, const float _mass);
+    void setPosition(const int i, const Eigen::Vector3f &_position) { store(position, i, _position); }
+    void setVelocity(const int i, const Eigen::Vector3f &_velocity) { store(velocity, i, _velocity); }
+    void setForce(const int i, const Eigen::Vector3f &_force) { store(force, i, _force); }
+    void setExternalForce(const int i, const Eigen::Vector3f &_force) { store(externalForce, i, _force); }
+    void setParticle(const int i, const Particle &particle);
+
+    //==========================================
+    //  method
+    //==========================================
+
+    void resize(const int _count);
+    void addPosition(const int i, const Eigen::Vector3f &_position) { accumulate(position, i, _position); }
+    void addVelocity(const int i, const Eigen::Vector3f &_velocity) { accumulate(velocity, i, _velocity); }
+    void addForce(const int i, const Eigen::Vector3f &_force) { accumulate(force, i, _force); }
+    void addExternalForce(const int i, const Eigen::Vector3f &_force) { accumulate(externalForce, i, _force); }
+    void clearExternalForce();
+
+ private:
+    using Component = std::array<FloatArray, 3>;
+
+    int count = 0;
+    Component position;
+    Component velocity;
+    Component force;
+    Component externalForce;
+    FloatArray mass;
+    FloatArray inverseMass;
+
+    static void store(Component &component, const int i, const Eigen::Vector3f &value) {
+        component[0][i] = value[0];
+        component[1][i] = value[1];
+        component[2][i] = value[2];
+    }
+    static void accumulate(Component &component, const int i, const Eigen::Vector3f &value) {
+        component[0][i] += value[0];
+        component[1][i] += value[1];
+        component[2][i] += value[2];
+    }
+};
+}  // namespace simulation
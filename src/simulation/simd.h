@@ -0,0 +1,82 @@
+#pragma once
+#include <cmath>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace simulation {
+// Thin wrappers so that one kernel body serves every instruction set. Mask holds one flag per lane, the result of a
+// comparison, and select(mask, a, b) picks a where it is set and b elsewhere. Without AVX the wrapper is one lane
+// wide; it lacks gather, so kernels that need it keep their own scalar path.
+#if defined(__AVX512F__)
+struct Simd {
+    using Float = __m512;
+    using Int = __m512i;
+    using Mask = __mmask16;
+    static constexpr int width = 16;
+
+    static Int loadInt(const int *p) { return _mm512_loadu_si512(p); }
+    static Float load(const float *p) { return _mm512_loadu_ps(p); }
+    static Float gather(const float *base, Int index) { return _mm512_i32gather_ps(index, base, 4); }
+    static Float set(const float value) { return _mm512_set1_ps(value); }
+    static Float add(Float a, Float b) { return _mm512_add_ps(a, b); }
+    static Float sub(Float a, Float b) { return _mm512_sub_ps(a, b); }
+    static Float mul(Float a, Float b) { return _mm512_mul_ps(a, b); }
+    static Float div(Float a, Float b) { return _mm512_div_ps(a, b); }
+    static Float sqrt(Float a) { return _mm512_sqrt_ps(a); }
+    static Float abs(Float a) { return _mm512_abs_ps(a); }
+    static Mask lessThan(Float a, Float b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+    static Mask greaterThan(Float a, Float b) { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+    static Mask both(Mask a, Mask b) { return a & b; }
+    static bool none(Mask a) { return a == 0; }
+    static Float select(Mask mask, Float a, Float b) { return _mm512_mask_blend_ps(mask, b, a); }
+    static void store(float *p, Float a) { _mm512_store_ps(p, a); }
+};
+#elif defined(__AVX2__)
+struct Simd {
+    using Float = __m256;
+    using Int = __m256i;
+    using Mask = __m256;
+    static constexpr int width = 8;
+
+    static Int loadInt(const int *p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p)); }
+    static Float load(const float *p) { return _mm256_loadu_ps(p); }
+    static Float gather(const float *base, Int index) { return _mm256_i32gather_ps(base, index, 4); }
+    static Float set(const float value) { return _mm256_set1_ps(value); }
+    static Float add(Float a, Float b) { return _mm256_add_ps(a, b); }
+    static Float sub(Float a, Float b) { return _mm256_sub_ps(a, b); }
+    static Float mul(Float a, Float b) { return _mm256_mul_ps(a, b); }
+    static Float div(Float a, Float b) { return _mm256_div_ps(a, b); }
+    static Float sqrt(Float a) { return _mm256_sqrt_ps(a); }
+    static Float abs(Float a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+    static Mask lessThan(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static Mask greaterThan(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+    static Mask both(Mask a, Mask b) { return _mm256_and_ps(a, b); }
+    static bool none(Mask a) { return _mm256_movemask_ps(a) == 0; }
+    static Float select(Mask mask, Float a, Float b) { return _mm256_blendv_ps(b, a, mask); }
+    static void store(float *p, Float a) { _mm256_store_ps(p, a); }
+};
+#else
+struct Simd {
+    using Float = float;
+    using Mask = bool;
+    static constexpr int width = 1;
+
+    static Float load(const float *p) { return *p; }
+    static Float set(const float value) { return value; }
+    static Float add(Float a, Float b) { return a + b; }
+    static Float sub(Float a, Float b) { return a - b; }
+    static Float mul(Float a, Float b) { return a * b; }
+    static Float div(Float a, Float b) { return a / b; }
+    static Float sqrt(Float a) { return std::sqrt(a); }
+    static Float abs(Float a) { return std::fabs(a); }
+    static Mask lessThan(Float a, Float b) { return a < b; }
+    static Mask greaterThan(Float a, Float b) { return a > b; }
+    static Mask both(Mask a, Mask b) { return a && b; }
+    static bool none(Mask a) { return !a; }
+    static Float select(Mask mask, Float a, Float b) { return mask ? a : b; }
+    static void store(float *p, Float a) { *p = a; }
+};
+#endif
+}  // namespace simulation
@@ -0,0 +1,126 @@
+#include "simulationThread.h"
+
+#include <algorithm>
+
+namespace simulation {
+// SimulationThread::EditLock
+
+SimulationThread::EditLock::EditLock(SimulationThread& thread) : owner(thread) {
+    {
+        std::lock_guard<std::mutex> lock(owner.editLock);
+        ++owner.pendingEdits;
+    }
+    owner.systemLock.lock();
+}
+
+SimulationThread::EditLock::~EditLock() {
+    owner.systemLock.unlock();
+    {
+        std::lock_guard<std::mutex> lock(owner.editLock);
+        --owner.pendingEdits;
+    }
+    owner.cvEdit.notify_all();
+}
+
+// SimulationThread
+
+SimulationThread::SimulationThread(MassSpringSystem& _system) : system(_system) {
+    thread = std::thread(&SimulationThread::run, this);
+}
+
+SimulationThread::~SimulationThread() {
+    {
+        std::lock_guard<std::mutex> lock(editLock);
+        stop = true;
+    }
+    cvEdit.notify_all();
+    thread.join();
+}
+
+void SimulationThread::setStepsPerBatch(const int steps) { stepsPerBatch.store(std::max(steps, 1)); }
+
+void SimulationThread::setBatchPeriod(const double seconds) { batchPeriod.store(std::max(seconds, 0.0)); }
+
+void SimulationThread::setFrameLocked(const bool isLocked) { isFrameLocked.store(isLocked); }
+
+void SimulationThread::stepBatch() {
+    const int steps = stepsPerBatch.load();
+    std::lock_guard<std::mutex> lock(systemLock);
+    for (int i = 0; i < steps; ++i) {
+        if (!step()) return;
+    }
+    const bool isStable = system.checkStable();
+    if (!isStable) system.isSimulating = false;
+    publish(isStable);
+}
+
+void SimulationThread::run() {
+    using clock = std::chrono::steady_clock;
+    // how often an idle thread looks for a started simulation
+    constexpr std::chrono::milliseconds idlePeriod(1);
+    clock::time_point deadline = clock::now();
+    while (true) {
+        const clock::time_point begin = clock::now();
+        bool isSimulating = !isFrameLocked.load();
+        const int steps = stepsPerBatch.load();
+        for (int i = 0; i < steps && isSimulating; ++i) {
+            if (!yieldToEdits()) return;
+            std::lock_guard<std::mutex> lock(systemLock);
+            // an edit may have stopped the system or locked the frames meanwhile
+            isSimulating = !isFrameLocked.load() && step();
+            if (isSimulating && i + 1 == steps) {
+                const bool isStable = system.checkStable();
+                if (!isStable) system.isSimulating = false;
+                publish(isStable);
+            }
+        }
+        const clock::time_point end = clock::now();
+        batchTime.store(isSimulating ? std::chrono::duration<double, std::milli>(end - begin).count() : 0.0);
+
+        // Keep to the period, a batch that ran late moves the schedule rather than being caught up
+        const auto period = std::chrono::duration_cast<clock::duration>(
+            std::chrono::duration<double>(batchPeriod.load()));
+        if (isSimulating) {
+            deadline = std::max(deadline + period, end);
+        } else {
+            deadline = end + std::max<clock::duration>(period, idlePeriod);
+        }
+        std::unique_lock<std::mutex> lock(editLock);
+        if (cvEdit.wait_until(lock, deadline, [this] { return stop; })) return;
+    }
+}
+
+bool SimulationThread::step() {
+    if (!system.isSimulating) return false;
+    system.simulationOneTimeStep();
+    ++stepCount;
+    return true;
+}
+
+void SimulationThread::publish(const bool isStable) {
+    Snapshot& snapshot = snapshots.back();
+    snapshot.cubeCount = system.getCubeCount();
+    snapshot.particleCountPerEdge = system.particleCountPerEdge;
+    snapshot.positions.resize(3LL * snapshot.cubeCount * snapshot.particleCountPerEdge *
+                              snapshot.particleCountPerEdge * snapshot.particleCountPerEdge);
+    float* position = snapshot.positions.data();
+    for (int cubeIdx = 0; cubeIdx < snapshot.cubeCount; ++cubeIdx) {
+        const ParticleStore& particles = system.getCubePointer(cubeIdx)->getParticles();
+        for (int axis = 0; axis < 3; ++axis) {
+            const float* data = particles.positionData(axis);
+            for (int i = 0; i < particles.size(); ++i) position[3 * i + axis] = data[i];
+        }
+        position += 3 * particles.size();
+    }
+    snapshot.step = stepCount;
+    snapshot.isStable = isStable;
+    snapshot.time = std::chrono::steady_clock::now();
+    snapshots.publish();
+}
+
+bool SimulationThread::yieldToEdits() {
+    std::unique_lock<std::mutex> lock(editLock);
+    cvEdit.wait(lock, [this] { return stop || pendingEdits == 0; });
+    return !stop;
+}
+}  // namespace simulation
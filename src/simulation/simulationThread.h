@@ -0,0 +1,107 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "../util/tripleBuffer.h"
+#include "massSpringSystem.h"
+
+namespace simulation {
+// State of a MassSpringSystem after a batch of steps, as the renderer needs it.
+struct Snapshot {
+    // x y z interleaved particle after particle and cube after cube, the layout of a trajectory frame
+    std::vector<float> positions;
+    int cubeCount = 0;
+    int particleCountPerEdge = 0;
+    long long step = 0;  // steps taken before it
+    bool isStable = true;
+    std::chrono::steady_clock::time_point time;  // when it was published
+};
+
+// Steps a MassSpringSystem on a thread of its own, stepsPerBatch steps every batchPeriod seconds, or as fast as it
+// can when it falls behind. After every batch it checks the stability, stopping the system when it blew up, and
+// publishes a Snapshot through a triple buffer, so the renderer never waits for the simulation nor the other way
+// around.
+// Every other thread edits the system, or reads what the simulation thread writes, only while holding an EditLock.
+// The simulation thread holds the lock for one step at a time and stands aside between two steps while an edit is
+// waiting for it.
+class SimulationThread final {
+ public:
+    class EditLock final {
+     public:
+        explicit EditLock(SimulationThread& thread);
+        ~EditLock();
+        EditLock(const EditLock&) = delete;
+        EditLock& operator=(const EditLock&) = delete;
+
+     private:
+        SimulationThread& owner;
+    };
+
+    // start stepping system, which must outlive the thread
+    explicit SimulationThread(MassSpringSystem& system);
+    // finish the step in progress, then join
+    ~SimulationThread();
+    SimulationThread(const SimulationThread&) = delete;
+    SimulationThread& operator=(const SimulationThread&) = delete;
+
+    //==========================================
+    //  getter
+    //==========================================
+
+    int getStepsPerBatch() const { return stepsPerBatch.load(); }
+    // milliseconds of the last batch of the thread, 0 while frame locked or not simulating
+    double getBatchTime() const { return batchTime.load(); }
+    // steps taken so far, only while holding an EditLock; every snapshot published later has a larger step
+    long long getStepCount() const { return stepCount; }
+
+    //==========================================
+    //  setter
+    //==========================================
+
+    void setStepsPerBatch(const int steps);
+    void setBatchPeriod(const double seconds);
+    // While frame locked the thread takes no step, the caller runs every batch with stepBatch(), for recordings
+    // whose frames have to be exactly one batch apart.
+    void setFrameLocked(const bool isLocked);
+
+    //==========================================
+    //  method
+    //==========================================
+
+    // Run one batch and publish its snapshot on the calling thread, only while frame locked.
+    void stepBatch();
+    // Move the snapshot to the newest published one, return false if there is none since the last call. The
+    // snapshot stays valid until the next call.
+    bool updateSnapshot() { return snapshots.update(); }
+    const Snapshot& getSnapshot() const { return snapshots.front(); }
+
+ private:
+    MassSpringSystem& system;
+    util::TripleBuffer<Snapshot> snapshots;
+    long long stepCount = 0;
+
+    std::atomic<int> stepsPerBatch{1};
+    std::atomic<double> batchPeriod{0.0};
+    std::atomic<bool> isFrameLocked{false};
+    std::atomic<double> batchTime{0.0};
+
+    std::mutex systemLock;  // held for each step and each edit
+    std::mutex editLock;    // guards pendingEdits and stop for the waits
+    std::condition_variable cvEdit;
+    int pendingEdits = 0;
+    bool stop = false;
+    std::thread thread;
+
+    void run();
+    // must hold systemLock, return false if the system is not simulating
+    bool step();
+    // must hold systemLock
+    void publish(const bool isStable);
+    // block while an edit waits for systemLock, return false once stopping
+    bool yieldToEdits();
+};
+}  // namespace simulation
@@ -0,0 +1,204 @@
+#include "sparseCholesky.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace simulation {
+void SparseCholesky::compute(const Eigen::SparseMatrix<float> &matrix) {
+    const int n = static_cast<int>(matrix.rows());
+
+    // 1. fill-reducing order, then its postorder along the elimination tree, which changes neither the tree nor
+    // the fill but numbers every subtree consecutively
+    Eigen::COLAMDOrdering<int> ordering;
+    Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic, int> order;
+    ordering(matrix, order);
+    Eigen::SparseMatrix<float> upper(n, n);
+    upper.selfadjointView<Eigen::Upper>() = matrix.selfadjointView<Eigen::Upper>().twistedBy(order);
+    std::vector<int> parent;
+    eliminationTree(upper, parent);
+    std::vector<int> firstChild(n, -1), nextSibling(n, -1), stack(n), rank(n);
+    for (int j = n - 1; j >= 0; --j) {
+        if (parent[j] == -1) continue;
+        nextSibling[j] = firstChild[parent[j]];
+        firstChild[parent[j]] = j;
+    }
+    int visited = 0;
+    for (int root = 0; root < n; ++root) {
+        if (parent[root] != -1) continue;
+        int top = 0;
+        stack[0] = root;
+        while (top >= 0) {
+            const int node = stack[top];
+            const int child = firstChild[node];
+            if (child == -1) {
+                rank[node] = visited++;
+                --top;
+            } else {
+                firstChild[node] = nextSibling[child];
+                stack[++top] = child;
+            }
+        }
+    }
+    for (int i = 0; i < n; ++i) order.indices()[i] = rank[order.indices()[i]];
+    permutation = order.indices();
+    upper.selfadjointView<Eigen::Upper>() = matrix.selfadjointView<Eigen::Upper>().twistedBy(order);
+    Eigen::SparseMatrix<float> lower(n, n);
+    lower.selfadjointView<Eigen::Lower>() = matrix.selfadjointView<Eigen::Upper>().twistedBy(order);
+    eliminationTree(upper, parent);
+
+    // 2. Row k of L is nonzero at the columns reached walking the tree up from the entries above the diagonal of
+    // column k; count the entries of every column
+    std::vector<int> flag(n, -1), columnCount(n, 1);
+    const auto reach = [&](const int k, const auto &visit) {
+        flag[k] = k;
+        for (Eigen::SparseMatrix<float>::InnerIterator it(upper, k); it; ++it) {
+            for (int i = static_cast<int>(it.row()); flag[i] != k; i = parent[i]) {
+                flag[i] = k;
+                visit(i);
+            }
+        }
+    };
+    for (int k = 0; k < n; ++k) reach(k, [&columnCount](const int j) { ++columnCount[j]; });
+
+    // 3. A column whose parent is the next column and holds one entry less has the same structure below the
+    // diagonal, both go in one supernode. Its rows are those of its first column.
+    std::vector<int> supernodeStart, supernodeOf(n);
+    for (int j = 0; j < n; ++j) {
+        if (j == 0 || parent[j - 1] != j || columnCount[j] != columnCount[j - 1] - 1) supernodeStart.push_back(j);
+        supernodeOf[j] = static_cast<int>(supernodeStart.size()) - 1;
+    }
+    const int supernodeCount = static_cast<int>(supernodeStart.size());
+    supernodeStart.push_back(n);
+    std::vector<int> rowStart(supernodeCount + 1), blockStart(supernodeCount + 1);
+    rowStart[0] = blockStart[0] = 0;
+    for (int s = 0; s < supernodeCount; ++s) {
+        const int rowCount = columnCount[supernodeStart[s]];
+        rowStart[s + 1] = rowStart[s] + rowCount;
+        blockStart[s + 1] = blockStart[s] + rowCount * (supernodeStart[s + 1] - supernodeStart[s]);
+    }
+    std::vector<int> rows(rowStart[supernodeCount]), rowFill(supernodeCount);
+    for (int s = 0; s < supernodeCount; ++s) {
+        rows[rowStart[s]] = supernodeStart[s];
+        rowFill[s] = rowStart[s] + 1;
+    }
+    std::fill(flag.begin(), flag.end(), -1);
+    for (int k = 0; k < n; ++k) {
+        reach(k, [&](const int j) {
+            const int s = supernodeOf[j];
+            if (supernodeStart[s] == j) rows[rowFill[s]++] = k;
+        });
+    }
+
+    // 4. Every supernode is a dense rows x columns block, column major, whose rows above the diagonal stay zero.
+    // Supernode K updates the later supernodes its rows fall into, it waits in the list of the supernode holding
+    // its next row.
+    std::vector<float> blocks(blockStart[supernodeCount], 0.0f);
+    std::vector<int> relative(n), waitingHead(supernodeCount, -1), waitingNext(supernodeCount), nextRow(supernodeCount);
+    using Block = Eigen::Map<Eigen::MatrixXf>;
+    for (int J = 0; J < supernodeCount; ++J) {
+        const int first = supernodeStart[J];
+        const int width = supernodeStart[J + 1] - first;
+        const int rowCount = rowStart[J + 1] - rowStart[J];
+        const int *rowsJ = rows.data() + rowStart[J];
+        Block block(blocks.data() + blockStart[J], rowCount, width);
+        for (int r = 0; r < rowCount; ++r) relative[rowsJ[r]] = r;
+        for (int c = 0; c < width; ++c) {
+            for (Eigen::SparseMatrix<float>::InnerIterator it(lower, first + c); it; ++it) {
+                block(relative[it.row()], c) = it.value();
+            }
+        }
+
+        for (int K = waitingHead[J]; K != -1;) {
+            const int nextK = waitingNext[K];
+            const int rowCountK = rowStart[K + 1] - rowStart[K];
+            const int *rowsK = rows.data() + rowStart[K];
+            const Block blockK(blocks.data() + blockStart[K], rowCountK, supernodeStart[K + 1] - supernodeStart[K]);
+            // rows [begin, end) of K are columns of J, the update covers the rows of K from begin on
+            const int begin = nextRow[K];
+            int end = begin;
+            while (end < rowCountK && rowsK[end] < first + width) ++end;
+            const Eigen::MatrixXf update =
+                blockK.middleRows(begin, rowCountK - begin) * blockK.middleRows(begin, end - begin).transpose();
+            for (int c = 0; c < end - begin; ++c) {
+                const int column = rowsK[begin + c] - first;
+                for (int r = c; r < rowCountK - begin; ++r) block(relative[rowsK[begin + r]], column) -= update(r, c);
+            }
+            nextRow[K] = end;
+            if (end < rowCountK) {
+                const int target = supernodeOf[rowsK[end]];
+                waitingNext[K] = waitingHead[target];
+                waitingHead[target] = K;
+            }
+            K = nextK;
+        }
+
+        Eigen::Ref<Eigen::MatrixXf> diagonal = block.topRows(width);
+        const Eigen::LLT<Eigen::Ref<Eigen::MatrixXf>> llt(diagonal);
+        if (llt.info() != Eigen::Success) {
+            throw std::runtime_error("SparseCholesky::compute : matrix is not positive definite");
+        }
+        if (rowCount > width) {
+            auto below = block.bottomRows(rowCount - width);
+            diagonal.triangularView<Eigen::Lower>().transpose().solveInPlace<Eigen::OnTheRight>(below);
+            nextRow[J] = width;
+            const int target = supernodeOf[rowsJ[width]];
+            waitingNext[J] = waitingHead[target];
+            waitingHead[target] = J;
+        }
+    }
+
+    // 5. copy the lower trapezoid of every block into the columns of L
+    factor.resize(n, n);
+    int *outer = factor.outerIndexPtr();
+    outer[0] = 0;
+    for (int j = 0; j < n; ++j) outer[j + 1] = outer[j] + columnCount[j];
+    factor.resizeNonZeros(outer[n]);
+    int *inner = factor.innerIndexPtr();
+    float *value = factor.valuePtr();
+    for (int s = 0; s < supernodeCount; ++s) {
+        const int rowCount = rowStart[s + 1] - rowStart[s];
+        const int width = supernodeStart[s + 1] - supernodeStart[s];
+        const Block block(blocks.data() + blockStart[s], rowCount, width);
+        for (int c = 0; c < width; ++c) {
+            const int j = supernodeStart[s] + c;
+            for (int r = c; r < rowCount; ++r) {
+                inner[outer[j] + r - c] = rows[rowStart[s] + r];
+                value[outer[j] + r - c] = block(r, c);
+            }
+        }
+    }
+    permuted.resize(n, 3);
+}
+
+void SparseCholesky::solve(const Eigen::MatrixX3f &rhs, Eigen::MatrixX3f &solution) {
+    const int n = rows();
+    const int *order = permutation.data();
+    // L L^T P x = P rhs
+    for (int axis = 0; axis < 3; ++axis) {
+        for (int i = 0; i < n; ++i) permuted(order[i], axis) = rhs(i, axis);
+    }
+    factor.triangularView<Eigen::Lower>().solveInPlace(permuted);
+    factor.transpose().triangularView<Eigen::Upper>().solveInPlace(permuted);
+    solution.resize(n, 3);
+    for (int axis = 0; axis < 3; ++axis) {
+        for (int i = 0; i < n; ++i) solution(i, axis) = permuted(order[i], axis);
+    }
+}
+
+void SparseCholesky::eliminationTree(const Eigen::SparseMatrix<float> &upper, std::vector<int> &parent) {
+    const int n = static_cast<int>(upper.cols());
+    // ancestor short-circuits the walk to the root found so far (path compression)
+    std::vector<int> ancestor(n, -1);
+    parent.assign(n, -1);
+    for (int k = 0; k < n; ++k) {
+        for (Eigen::SparseMatrix<float>::InnerIterator it(upper, k); it; ++it) {
+            for (int i = static_cast<int>(it.row()); i != -1 && i < k;) {
+                const int next = ancestor[i];
+                ancestor[i] = k;
+                if (next == -1) parent[i] = k;
+                i = next;
+            }
+        }
+    }
+}
+}  // namespace simulation
@@ -0,0 +1,44 @@
+#pragma once
+#include <vector>
+
+#include "Eigen/Dense"
+#include "Eigen/Sparse"
+
+namespace simulation {
+// Sparse Cholesky factorization P A P^T = L L^T of a symmetric positive definite matrix, for the solvers that
+// factor a constant matrix once and solve with it every step. The sparse Cholesky module of Eigen is excluded by
+// EIGEN_MPL2_ONLY and SparseLU::solve allocates working storage on every call, this one solves in place.
+// The columns are put in the COLAMD order, then postordered along the elimination tree so that columns of equal
+// structure below the diagonal are consecutive; such a supernode is factored as one dense block, with matrix
+// products for the updates from the supernodes before it (left-looking). L is kept as a compressed column matrix.
+class SparseCholesky {
+ public:
+    //==========================================
+    //  getter
+    //==========================================
+
+    int rows() const { return static_cast<int>(permutation.size()); }
+    // nonzeros of L
+    int getNonZeroCount() const { return static_cast<int>(factor.nonZeros()); }
+
+    //==========================================
+    //  method
+    //==========================================
+
+    // factor matrix, both triangles of which must be stored, throw std::runtime_error if it is not positive definite
+    void compute(const Eigen::SparseMatrix<float> &matrix);
+    // solution = A^-1 rhs through the factor, without allocating once solution has rows() rows
+    void solve(const Eigen::MatrixX3f &rhs, Eigen::MatrixX3f &solution);
+
+ private:
+    // lower triangular factor, the diagonal first in every column
+    Eigen::SparseMatrix<float> factor;
+    // row i of A is row permutation[i] of P A P^T
+    Eigen::VectorXi permutation;
+    // right-hand side in the factor's order, rows() x 3
+    Eigen::MatrixX3f permuted;
+
+    // parent of every column in the elimination tree of the upper triangle upper, -1 for a root
+    static void eliminationTree(const Eigen::SparseMatrix<float> &upper, std::vector<int> &parent);
+};
+}  // namespace simulation
@@ -0,0 +1,119 @@
+#include "spatialHash.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "../util/threadPool.h"
+
+namespace simulation {
+namespace {
+// points per parallel chunk
+constexpr int pointGrain = 1024;
+// buckets per parallel chunk, also the block size of the prefix sum
+constexpr int bucketGrain = 4096;
+}  // namespace
+
+int SpatialHash::getNeighborBuckets(const float x, const float y, const float z, int *buckets) const {
+    const int ci = cellCoordinate(x);
+    const int cj = cellCoordinate(y);
+    const int ck = cellCoordinate(z);
+    int count = 0;
+    for (int i = ci - 1; i <= ci + 1; ++i) {
+        for (int j = cj - 1; j <= cj + 1; ++j) {
+            for (int k = ck - 1; k <= ck + 1; ++k) {
+                const int bucket = static_cast<int>(hashCell(i, j, k));
+                // two cells sharing a bucket must not report its points twice
+                if (std::find(buckets, buckets + count, bucket) == buckets + count) buckets[count++] = bucket;
+            }
+        }
+    }
+    return count;
+}
+
+void SpatialHash::build(const float *x, const float *y, const float *z, const int count, const float _cellSize) {
+    auto &pool = util::ThreadPool::getInstance();
+    cellSize = _cellSize;
+    inverseCellSize = 1.0f / _cellSize;
+
+    // at least two buckets per point keeps the chains short
+    int bucketCount = 1;
+    while (bucketCount < 2 * count) bucketCount <<= 1;
+    bucketMask = static_cast<unsigned>(bucketCount - 1);
+    if (bucketCount > capacity) {
+        capacity = bucketCount;
+        bucketCounters = std::make_unique<std::atomic<int>[]>(capacity);
+    }
+    bucketOffsets.resize(bucketCount + 1);
+    pointBuckets.resize(count);
+    points.resize(count);
+
+    // 1. count the points of every bucket
+    pool.parallelFor(0, bucketCount, bucketGrain, [this](const int begin, const int end) {
+        for (int b = begin; b < end; ++b) bucketCounters[b].store(0, std::memory_order_relaxed);
+    });
+    pool.parallelFor(0, count, pointGrain, [&](const int begin, const int end) {
+        for (int i = begin; i < end; ++i) {
+            const unsigned bucket = hashCell(cellCoordinate(x[i]), cellCoordinate(y[i]), cellCoordinate(z[i]));
+            pointBuckets[i] = static_cast<int>(bucket);
+            bucketCounters[bucket].fetch_add(1, std::memory_order_relaxed);
+        }
+    });
+
+    // 2. exclusive prefix sum of the counts: sum blocks in parallel, scan the block sums, then scan every block
+    const int blockCount = (bucketCount + bucketGrain - 1) / bucketGrain;
+    blockSums.resize(blockCount + 1);
+    pool.parallelFor(0, blockCount, 1, [&](const int begin, const int end) {
+        for (int block = begin; block < end; ++block) {
+            int sum = 0;
+            const int last = std::min((block + 1) * bucketGrain, bucketCount);
+            for (int b = block * bucketGrain; b < last; ++b) sum += bucketCounters[b].load(std::memory_order_relaxed);
+            blockSums[block + 1] = sum;
+        }
+    });
+    blockSums[0] = 0;
+    for (int block = 0; block < blockCount; ++block) blockSums[block + 1] += blockSums[block];
+    pool.parallelFor(0, blockCount, 1, [&](const int begin, const int end) {
+        for (int block = begin; block < end; ++block) {
+            int offset = blockSums[block];
+            const int last = std::min((block + 1) * bucketGrain, bucketCount);
+            for (int b = block * bucketGrain; b < last; ++b) {
+                const int bucketSize = bucketCounters[b].load(std::memory_order_relaxed);
+                bucketOffsets[b] = offset;
+                // the counter becomes the insertion cursor of the bucket
+                bucketCounters[b].store(offset, std::memory_order_relaxed);
+                offset += bucketSize;
+            }
+        }
+    });
+    bucketOffsets[bucketCount] = count;
+
+    // 3. scatter the points, then restore index order inside every bucket since the scatter order is arbitrary
+    pool.parallelFor(0, count, pointGrain, [this](const int begin, const int end) {
+        for (int i = begin; i < end; ++i) {
+            points[bucketCounters[pointBuckets[i]].fetch_add(1, std::memory_order_relaxed)] = i;
+        }
+    });
+    pool.parallelFor(0, bucketCount, bucketGrain, [this](const int begin, const int end) {
+        for (int b = begin; b < end; ++b) {
+            // buckets hold a handful of points, insertion sort is the cheapest
+            for (int i = bucketOffsets[b] + 1; i < bucketOffsets[b + 1]; ++i) {
+                const int point = points[i];
+                int j = i;
+                for (; j > bucketOffsets[b] && points[j - 1] > point; --j) points[j] = points[j - 1];
+                points[j] = point;
+            }
+        }
+    });
+}
+
+int SpatialHash::cellCoordinate(const float value) const {
+    return static_cast<int>(std::floor(value * inverseCellSize));
+}
+
+unsigned SpatialHash::hashCell(const int i, const int j, const int k) const {
+    // large primes of Teschner et al., "Optimized Spatial Hashing for Collision Detection of Deformable Objects"
+    const unsigned hash = (static_cast<unsigned>(i) * 73856093u) ^ (static_cast<unsigned>(j) * 19349663u) ^
+                          (static_cast<unsigned>(k) * 83492791u);
+    return hash & bucketMask;
+}
+}  // namespace simulation
@@ -0,0 +1,49 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace simulation {
+// Uniform grid over a point cloud, stored as a hash table of cells.
+// build() bins the points with a parallel counting sort, so rebuilding it every step costs O(n) in the point count.
+// Points of a bucket are kept in increasing index order, which makes queries independent of thread scheduling.
+// Distinct cells may share a bucket, so callers must still test the distance of every candidate.
+class SpatialHash {
+ public:
+    // upper bound of getNeighborBuckets
+    static constexpr int maxNeighborBuckets = 27;
+
+    //==========================================
+    //  getter
+    //==========================================
+
+    float getCellSize() const { return cellSize; }
+    // points of bucket b are getPointData()[getBucketBegin(b) ... getBucketBegin(b + 1) - 1]
+    int getBucketBegin(const int bucket) const { return bucketOffsets[bucket]; }
+    const int *getPointData() const { return points.data(); }
+    // write the distinct buckets of the 3x3x3 cells around position into buckets, return how many there are
+    int getNeighborBuckets(const float x, const float y, const float z, int *buckets) const;
+
+    //==========================================
+    //  method
+    //==========================================
+
+    // rebuild the table over points [0, count) whose coordinates are x[i], y[i], z[i], with cubic cells of cellSize
+    void build(const float *x, const float *y, const float *z, const int count, const float cellSize);
+
+ private:
+    float cellSize = 1.0f;
+    float inverseCellSize = 1.0f;
+    unsigned bucketMask = 0;  // bucket count minus one, the count being a power of two
+    int capacity = 0;         // bucket count the counters are allocated for
+
+    std::unique_ptr<std::atomic<int>[]> bucketCounters;  // point count, then insertion cursor of every bucket
+    std::vector<int> bucketOffsets;                      // exclusive prefix sum of the counts, plus the total
+    std::vector<int> blockSums;                          // partial sums of the parallel scan
+    std::vector<int> pointBuckets;                       // bucket of every point
+    std::vector<int> points;                             // point indices sorted by bucket
+
+    int cellCoordinate(const float value) const;
+    unsigned hashCell(const int i, const int j, const int k) const;
+};
+}  // namespace simulation
@@ -0,0 +1,152 @@
+#include "springKernel.h"
+
+#include <atomic>
+#include <cmath>
+
+#include "simd.h"
+
+namespace simulation {
+namespace {
+#if defined(__AVX512F__) || defined(__AVX2__)
+// Evaluate whole blocks of Simd::width springs, return the index of the first spring left over.
+int accumulateSpringBlocks(const SpringBatch &springs, const int begin, const int end, ParticleStore &particles) {
+    alignas(64) float force[3][Simd::width];
+    const int *startID = springs.startData();
+    const int *endID = springs.endData();
+    const float *position[3] = {particles.positionData(0), particles.positionData(1), particles.positionData(2)};
+    const float *velocity[3] = {particles.velocityData(0), particles.velocityData(1), particles.velocityData(2)};
+    float *particleForce[3] = {particles.forceData(0), particles.forceData(1), particles.forceData(2)};
+    const Simd::Float one = Simd::set(1.0f);
+
+    int i = begin;
+    for (; i + Simd::width <= end; i += Simd::width) {
+        const Simd::Int a = Simd::loadInt(startID + i);
+        const Simd::Int b = Simd::loadInt(endID + i);
+        Simd::Float delta[3], deltaVelocity[3];
+        for (int axis = 0; axis < 3; ++axis) {
+            delta[axis] = Simd::sub(Simd::gather(position[axis], a), Simd::gather(position[axis], b));
+            deltaVelocity[axis] = Simd::sub(Simd::gather(velocity[axis], a), Simd::gather(velocity[axis], b));
+        }
+        Simd::Float lengthSquared = Simd::mul(delta[0], delta[0]);
+        lengthSquared = Simd::add(lengthSquared, Simd::mul(delta[1], delta[1]));
+        lengthSquared = Simd::add(lengthSquared, Simd::mul(delta[2], delta[2]));
+        Simd::Float projection = Simd::mul(deltaVelocity[0], delta[0]);
+        projection = Simd::add(projection, Simd::mul(deltaVelocity[1], delta[1]));
+        projection = Simd::add(projection, Simd::mul(deltaVelocity[2], delta[2]));
+
+        const Simd::Float length = Simd::sqrt(lengthSquared);
+        const Simd::Float inverseLength = Simd::div(one, length);
+        const Simd::Float restLength = Simd::load(springs.restLengthData() + i);
+        const Simd::Float stretch = Simd::mul(Simd::load(springs.springCoefData() + i), Simd::sub(length, restLength));
+        const Simd::Float damping =
+            Simd::mul(Simd::mul(Simd::load(springs.damperCoefData() + i), projection), inverseLength);
+        // force on the start particle is -scale * delta
+        const Simd::Float scale = Simd::mul(Simd::add(stretch, damping), inverseLength);
+        for (int axis = 0; axis < 3; ++axis) Simd::store(force[axis], Simd::mul(scale, delta[axis]));
+
+        // scatter serially, two lanes may share a particle
+        for (int lane = 0; lane < Simd::width; ++lane) {
+            const int start = startID[i + lane];
+            const int finish = endID[i + lane];
+            for (int axis = 0; axis < 3; ++axis) {
+                particleForce[axis][start] -= force[axis][lane];
+                particleForce[axis][finish] += force[axis][lane];
+            }
+        }
+    }
+    return i;
+}
+#endif
+}  // namespace
+
+unsigned SpringBatch::nextRevision() {
+    static std::atomic<unsigned> counter{0};
+    return ++counter;
+}
+
+void SpringBatch::assign(const std::vector<Spring> &springs, const int particleCount) {
+    const int springNum = static_cast<int>(springs.size());
+    startID.resize(springNum);
+    endID.resize(springNum);
+    restLength.resize(springNum);
+    springCoef.resize(springNum);
+    damperCoef.resize(springNum);
+    for (int i = 0; i < springNum; ++i) {
+        startID[i] = springs[i].getSpringStartID();
+        endID[i] = springs[i].getSpringEndID();
+        restLength[i] = springs[i].getSpringRestLength();
+        springCoef[i] = springs[i].getSpringCoef();
+        damperCoef[i] = springs[i].getDamperCoef();
+    }
+
+    incidentOffsets.assign(particleCount + 1, 0);
+    for (int i = 0; i < springNum; ++i) {
+        ++incidentOffsets[startID[i] + 1];
+        ++incidentOffsets[endID[i] + 1];
+    }
+    for (int i = 0; i < particleCount; ++i) incidentOffsets[i + 1] += incidentOffsets[i];
+    std::vector<int> slot(incidentOffsets.begin(), incidentOffsets.end() - 1);
+    incidentSprings.resize(2 * springNum);
+    for (int i = 0; i < springNum; ++i) {
+        incidentSprings[slot[startID[i]]++] = 2 * i;
+        incidentSprings[slot[endID[i]]++] = 2 * i + 1;
+    }
+    revision = nextRevision();
+}
+
+void accumulateSpringForce(const SpringBatch &springs, const int begin, const int end, ParticleStore &particles) {
+#if defined(__AVX512F__) || defined(__AVX2__)
+    int i = accumulateSpringBlocks(springs, begin, end, particles);
+#else
+    int i = begin;
+#endif
+    const int *startID = springs.startData();
+    const int *endID = springs.endData();
+    for (; i < end; ++i) {
+        const int start = startID[i];
+        const int finish = endID[i];
+        const Eigen::Vector3f delta = particles.getPosition(start) - particles.getPosition(finish);
+        const Eigen::Vector3f deltaVelocity = particles.getVelocity(start) - particles.getVelocity(finish);
+        const float length = delta.norm();
+        const float inverseLength = 1.0f / length;
+        const float stretch = springs.springCoefData()[i] * (length - springs.restLengthData()[i]);
+        const float damping = springs.damperCoefData()[i] * deltaVelocity.dot(delta) * inverseLength;
+        const Eigen::Vector3f force = (stretch + damping) * inverseLength * delta;
+        particles.addForce(start, -force);
+        particles.addForce(finish, force);
+    }
+}
+
+void gatherSpringForce(const SpringBatch &springs, const int begin, const int end, ParticleStore &particles) {
+    const int *startID = springs.startData();
+    const int *endID = springs.endData();
+    const int *offsets = springs.incidentOffsetData();
+    const int *incident = springs.incidentSpringData();
+    const float *position[3] = {particles.positionData(0), particles.positionData(1), particles.positionData(2)};
+    const float *velocity[3] = {particles.velocityData(0), particles.velocityData(1), particles.velocityData(2)};
+    float *force[3] = {particles.forceData(0), particles.forceData(1), particles.forceData(2)};
+
+    for (int particle = begin; particle < end; ++particle) {
+        float sum[3] = {0.0f, 0.0f, 0.0f};
+        for (int entry = offsets[particle]; entry < offsets[particle + 1]; ++entry) {
+            const int spring = incident[entry] >> 1;
+            // the other endpoint, delta always points from it to this particle
+            const int other = (incident[entry] & 1) ? startID[spring] : endID[spring];
+            float delta[3], deltaVelocity[3];
+            for (int axis = 0; axis < 3; ++axis) {
+                delta[axis] = position[axis][particle] - position[axis][other];
+                deltaVelocity[axis] = velocity[axis][particle] - velocity[axis][other];
+            }
+            const float length = std::sqrt(delta[0] * delta[0] + delta[1] * delta[1] + delta[2] * delta[2]);
+            const float inverseLength = 1.0f / length;
+            const float projection =
+                deltaVelocity[0] * delta[0] + deltaVelocity[1] * delta[1] + deltaVelocity[2] * delta[2];
+            const float stretch = springs.springCoefData()[spring] * (length - springs.restLengthData()[spring]);
+            const float damping = springs.damperCoefData()[spring] * projection * inverseLength;
+            const float scale = (stretch + damping) * inverseLength;
+            for (int axis = 0; axis < 3; ++axis) sum[axis] -= scale * delta[axis];
+        }
+        for (int axis = 0; axis < 3; ++axis) force[axis][particle] += sum[axis];
+    }
+}
+}  // namespace simulation
@@ -0,0 +1,76 @@
+#pragma once
+#include <vector>
+
+#include "../util/alignedAllocator.h"
+#include "particleStore.h"
+#include "spring.h"
+
+namespace simulation {
+// Structure-of-arrays copy of a cube's spring list, kept in the same order as the Spring objects so the force
+// kernels can load 8 or 16 springs at once. It also holds a compressed sparse row adjacency listing the springs
+// incident to every particle, used by the gather kernel.
+class SpringBatch {
+ public:
+    using IntArray = std::vector<int, util::AlignedAllocator<int>>;
+    using FloatArray = ParticleStore::FloatArray;
+
+    //==========================================
+    //  getter
+    //==========================================
+
+    int size() const { return static_cast<int>(startID.size()); }
+    const int *startData() const { return startID.data(); }
+    const int *endData() const { return endID.data(); }
+    const float *restLengthData() const { return restLength.data(); }
+    const float *springCoefData() const { return springCoef.data(); }
+    const float *damperCoefData() const { return damperCoef.data(); }
+    // springs incident to particle i are entries [incidentOffsets[i], incidentOffsets[i + 1]), each entry being
+    // 2 * springIndex, plus one when the particle is the spring's end
+    const int *incidentOffsetData() const { return incidentOffsets.data(); }
+    const int *incidentSpringData() const { return incidentSprings.data(); }
+    // changes whenever topology or coefficients change, unique across batches, so solvers can cache
+    // factorizations keyed on it
+    unsigned getRevision() const { return revision; }
+
+    //==========================================
+    //  setter
+    //==========================================
+
+    void setSpringCoef(const int i, const float _springCoef) {
+        springCoef[i] = _springCoef;
+        revision = nextRevision();
+    }
+    void setDamperCoef(const int i, const float _damperCoef) {
+        damperCoef[i] = _damperCoef;
+        revision = nextRevision();
+    }
+
+    //==========================================
+    //  method
+    //==========================================
+
+    void assign(const std::vector<Spring> &springs, const int particleCount);
+
+ private:
+    IntArray startID;
+    IntArray endID;
+    FloatArray restLength;
+    FloatArray springCoef;
+    FloatArray damperCoef;
+    std::vector<int> incidentOffsets;
+    std::vector<int> incidentSprings;
+    unsigned revision = 0;
+
+    static unsigned nextRevision();
+};
+
+// Accumulate spring and damper forces of springs [begin, end) into the particles' force arrays.
+// Each spring's length is computed once and equal-and-opposite forces are applied to both endpoints. With AVX-512
+// or AVX2 enabled at compile time, 16 or 8 springs are evaluated per iteration. Results match the former scalar
+// per-endpoint evaluation to within 1e-5 of the largest force magnitude; only the rounding order differs.
+void accumulateSpringForce(const SpringBatch &springs, const int begin, const int end, ParticleStore &particles);
+// Add the spring and damper forces acting on particles [begin, end) by walking each particle's incident springs.
+// Every spring is evaluated once per endpoint, but each particle only writes its own force, so disjoint ranges
+// can run concurrently and the summation order is fixed.
+void gatherSpringForce(const SpringBatch &springs, const int begin, const int end, ParticleStore &particles);
+}  // namespace simulation
@@ -1,13 +1,163 @@
 #include "terrain.h"
 
+#include <algorithm>
 #include <stdexcept>
 #include <iostream>
 #include <stdlib.h>
 
 #include "particle.h"
+#include "simd.h"
+#include "../util/filesystem.h"
 #include "../util/helper.h"
+#include "../util/threadPool.h"
 
 namespace simulation {
+namespace {
+// Move particle i by depth along the unit normal, then remove the tangential part of its displacement since
+// previous up to friction * depth, i.e. static friction sticks and kinetic friction slows the particle down.
+void projectParticle(const Eigen::Vector3f& previous, const Eigen::Vector3f& normal, const float depth,
+                     const float friction, const int i, ParticleStore& particles) {
+    const Eigen::Vector3f position = particles.getPosition(i) + depth * normal;
+    const Eigen::Vector3f displacement = position - previous;
+    const Eigen::Vector3f tangent = displacement - displacement.dot(normal) * normal;
+    const float slide = tangent.norm();
+    const float scale = slide > friction * depth ? friction * depth / slide : 1.0f;
+    particles.setPosition(i, position - scale * tangent);
+}
+
+// Velocity based response of the sampled terrains, matching the analytic ones: a particle closer than eEPSILON to
+// the surface and moving into it is lifted, its normal velocity is reflected and the contact and friction forces
+// cancel the force pushing it in.
+void collideParticle(const float distance, const Eigen::Vector3f& normal, const float friction, const int i,
+                     ParticleStore& particles) {
+    constexpr float eEPSILON = 0.01f;
+    constexpr float coefResist = 0.8f;
+
+    const Eigen::Vector3f velocity = particles.getVelocity(i);
+    if (distance < eEPSILON && normal.dot(velocity) < 0) {
+        const Eigen::Vector3f vn = velocity.dot(normal) * normal;
+        const Eigen::Vector3f vt = velocity - vn;
+
+        particles.addPosition(i, normal * eEPSILON);
+        particles.setVelocity(i, -coefResist * vn + vt);
+
+        const float normalForce = normal.dot(particles.getForce(i));
+        if (normalForce < 0) particles.addForce(i, -normalForce * normal + friction * normalForce * vt);
+    }
+}
+
+// Raw component arrays of the particles, the analytic terrains sweep them Simd::width lanes at a time. Arrays are
+// padded to whole registers and padding particles are at rest, so they never register a contact.
+struct ParticleArrays {
+    float* position[3];
+    float* velocity[3];
+    float* force[3];
+    int size;
+
+    explicit ParticleArrays(ParticleStore& particles) : size(particles.paddedSize()) {
+        for (int axis = 0; axis < 3; ++axis) {
+            position[axis] = particles.positionData(axis);
+            velocity[axis] = particles.velocityData(axis);
+            force[axis] = particles.forceData(axis);
+        }
+    }
+};
+
+// Contact response of the analytic terrains for the lanes of hit in the block starting at i, the others are left
+// untouched: lift by push * normal, reflect the normal velocity and cancel the force pushing into the surface.
+// The normal velocity is normalVelocity * inverseNorm * normal, so normal need not be a unit vector.
+void respondBlock(const int i, const Simd::Mask hit, const Simd::Float (&normal)[3], const Simd::Float normalVelocity,
+                  const Simd::Float (&position)[3], const Simd::Float (&velocity)[3], const float inverseNorm,
+                  const float push, const float friction, const ParticleArrays& arrays) {
+    constexpr float coefResist = 0.8f;
+
+    Simd::Float force[3];
+    Simd::Float normalForce = Simd::set(0.0f);
+    for (int axis = 0; axis < 3; ++axis) {
+        force[axis] = Simd::load(arrays.force[axis] + i);
+        normalForce = Simd::add(normalForce, Simd::mul(normal[axis], force[axis]));
+    }
+    const Simd::Mask pressed = Simd::both(hit, Simd::lessThan(normalForce, Simd::set(0.0f)));
+    const Simd::Float along = Simd::mul(normalVelocity, Simd::set(inverseNorm));
+    const Simd::Float frictionForce = Simd::mul(Simd::set(friction), normalForce);
+    for (int axis = 0; axis < 3; ++axis) {
+        const Simd::Float vn = Simd::mul(along, normal[axis]);
+        const Simd::Float vt = Simd::sub(velocity[axis], vn);
+        const Simd::Float lifted = Simd::add(position[axis], Simd::mul(Simd::set(push), normal[axis]));
+        const Simd::Float reflected = Simd::add(Simd::mul(Simd::set(-coefResist), vn), vt);
+        const Simd::Float contact = Simd::sub(Simd::mul(frictionForce, vt), Simd::mul(normalForce, normal[axis]));
+        Simd::store(arrays.position[axis] + i, Simd::select(hit, lifted, position[axis]));
+        Simd::store(arrays.velocity[axis] + i, Simd::select(hit, reflected, velocity[axis]));
+        Simd::store(arrays.force[axis] + i, Simd::select(pressed, Simd::add(force[axis], contact), force[axis]));
+    }
+}
+
+// Particles closer than eEPSILON to the plane through point and moving into it bounce off, normal is constant so its
+// broadcast and inverse norm are hoisted out of the sweep.
+void collidePlane(const Eigen::Vector3f& point, const Eigen::Vector3f& normal, const float push, const float friction,
+                  ParticleStore& particles) {
+    constexpr float eEPSILON = 0.01f;
+
+    const ParticleArrays arrays(particles);
+    const Simd::Float n[3] = {Simd::set(normal[0]), Simd::set(normal[1]), Simd::set(normal[2])};
+    const Simd::Float offset = Simd::set(normal.dot(point));
+    const Simd::Float epsilon = Simd::set(eEPSILON);
+    const Simd::Float zero = Simd::set(0.0f);
+    const float inverseNorm = 1.0f / normal.norm();
+    for (int i = 0; i < arrays.size; i += Simd::width) {
+        Simd::Float position[3], velocity[3];
+        Simd::Float height = zero;
+        Simd::Float normalVelocity = zero;
+        for (int axis = 0; axis < 3; ++axis) {
+            position[axis] = Simd::load(arrays.position[axis] + i);
+            velocity[axis] = Simd::load(arrays.velocity[axis] + i);
+            height = Simd::add(height, Simd::mul(n[axis], position[axis]));
+            normalVelocity = Simd::add(normalVelocity, Simd::mul(n[axis], velocity[axis]));
+        }
+        const Simd::Mask hit = Simd::both(Simd::lessThan(Simd::abs(Simd::sub(offset, height)), epsilon),
+                                          Simd::lessThan(normalVelocity, zero));
+        if (Simd::none(hit)) continue;
+        respondBlock(i, hit, n, normalVelocity, position, velocity, inverseNorm, push, friction, arrays);
+    }
+}
+
+// Particles closer than eEPSILON to the sphere around center and moving into it bounce off. The outside of the
+// sphere is free space, or the inside if inside is set, as for a bowl.
+void collideSphere(const Eigen::Vector3f& center, const float radius, const bool inside, const float friction,
+                   ParticleStore& particles) {
+    constexpr float eEPSILON = 0.01f;
+
+    const ParticleArrays arrays(particles);
+    // the normal points from the center for a sphere and toward it for a bowl
+    const float sign = inside ? -1.0f : 1.0f;
+    const Simd::Float c[3] = {Simd::set(center[0]), Simd::set(center[1]), Simd::set(center[2])};
+    const Simd::Float s = Simd::set(sign);
+    const Simd::Float limit = Simd::set(radius + eEPSILON);
+    const Simd::Float zero = Simd::set(0.0f);
+    for (int i = 0; i < arrays.size; i += Simd::width) {
+        Simd::Float position[3], velocity[3], normal[3];
+        Simd::Float distanceSquared = zero;
+        for (int axis = 0; axis < 3; ++axis) {
+            position[axis] = Simd::load(arrays.position[axis] + i);
+            velocity[axis] = Simd::load(arrays.velocity[axis] + i);
+            normal[axis] = Simd::mul(s, Simd::sub(position[axis], c[axis]));
+            distanceSquared = Simd::add(distanceSquared, Simd::mul(normal[axis], normal[axis]));
+        }
+        const Simd::Float distance = Simd::sqrt(distanceSquared);
+        Simd::Float normalVelocity = zero;
+        for (int axis = 0; axis < 3; ++axis) {
+            // a particle at the center gets a NaN normal, which fails every comparison below
+            normal[axis] = Simd::div(normal[axis], distance);
+            normalVelocity = Simd::add(normalVelocity, Simd::mul(normal[axis], velocity[axis]));
+        }
+        const Simd::Mask near = inside ? Simd::greaterThan(distance, limit) : Simd::lessThan(distance, limit);
+        const Simd::Mask hit = Simd::both(near, Simd::lessThan(normalVelocity, zero));
+        if (Simd::none(hit)) continue;
+        respondBlock(i, hit, normal, normalVelocity, position, velocity, 1.0f, eEPSILON, friction, arrays);
+    }
+}
+}  // namespace
+
 // Factory
 std::unique_ptr<Terrain> TerrainFactory::CreateTerrain(TerrainType type) {
     switch (type) {
@@ -19,15 +169,34 @@ std::unique_ptr<Terrain> TerrainFactory::CreateTerrain(TerrainType type) {
             return std::make_unique<BowlTerrain>();
         case simulation::TerrainType::TiltedPlane:
             return std::make_unique<TiltedPlaneTerrain>();
+        case simulation::TerrainType::Heightfield: {
+            const util::Image image(util::PathFinder::find("Texture/heightmap.png"), 1);
+            return std::make_unique<HeightfieldTerrain>(image, Eigen::Vector3f(0.0f, -1.0f, 0.0f), 48.0f, 6.0f);
+        }
+        case simulation::TerrainType::SDF:
+            throw std::invalid_argument("TerrainFactory::CreateTerrain : SDF needs a source, use CreateSDFTerrain");
         default:
             throw std::invalid_argument("TerrainFactory::CreateTerrain : invalid TerrainType");
             break;
     }
     return nullptr;
 }
+
+std::unique_ptr<Terrain> TerrainFactory::CreateSDFTerrain(TerrainType source) {
+    // covers the heightfield, the cubes' spawn height and most of the slide down the tilted plane
+    const Eigen::AlignedBox3f bounds(Eigen::Vector3f(-24.0f, -24.0f, -24.0f), Eigen::Vector3f(24.0f, 16.0f, 24.0f));
+    constexpr float cellSize = 0.5f;
+    // same coefficients as the analytic versions
+    const float friction = source == TerrainType::Plane || source == TerrainType::Heightfield ? 0.7f : 0.3f;
+    const auto terrain = CreateTerrain(source);
+    auto sdf = std::make_unique<SDFTerrain>(*terrain, bounds, cellSize, friction);
+    sdf->modelMatrix = terrain->getModelMatrix();
+    sdf->sourceType = source;
+    return sdf;
+}
 // Terrain
 
-Eigen::Matrix4f Terrain::getModelMatrix() { return modelMatrix; }
+Eigen::Matrix4f Terrain::getModelMatrix() const { return modelMatrix; }
 
 // Note:
 // You should update each particles' velocity (base on the equation in
@@ -41,34 +210,28 @@ TerrainType PlaneTerrain::getType() { return TerrainType::Plane; }
 
 void PlaneTerrain::handleCollision(const float delta_T, Cube& cube) {
     constexpr float eEPSILON = 0.01f;
-    constexpr float coefResist = 0.8f;
     constexpr float coefFriction = 0.7f;
-   
-    std::vector<simulation::Particle> * particles = cube.getParticlePointer();
-    for (int i = 0; i < particles->size(); ++i) {
-        if (fabs(this->normal.dot(this->position - (*particles)[i].getPosition())) < eEPSILON
-            && this->normal.dot((*particles)[i].getVelocity()) < 0)
-        {
-            Eigen::Vector3f vn = (*particles)[i].getVelocity().dot(this->normal) / (this->normal).norm() * this->normal;
-            Eigen::Vector3f vt = (*particles)[i].getVelocity() - vn;
-
-            (*particles)[i].setPosition((*particles)[i].getPosition() + this->normal * eEPSILON);
-            (*particles)[i].setVelocity(-coefResist * vn + vt);
-
-            Eigen::Vector3f fc = Eigen::Vector3f::Zero();
-            Eigen::Vector3f ff = Eigen::Vector3f::Zero();
-
-            if (this->normal.dot((*particles)[i].getForce()) < 0) 
-            {
-                fc = -(this->normal.dot((*particles)[i].getForce())) * this->normal;
-                ff = -coefFriction * (-this->normal.dot((*particles)[i].getForce())) * vt;
-            }
+    collidePlane(this->position, this->normal, eEPSILON, coefFriction, cube.getParticles());
+}
+
 
-            (*particles)[i].addForce(fc + ff);
+void PlaneTerrain::projectContact(const Eigen::MatrixX3f& previousPosition, Cube& cube) {
+    constexpr float coefFriction = 0.7f;
+    const Eigen::Vector3f unitNormal = this->normal.normalized();
+
+    ParticleStore& particles = cube.getParticles();
+    for (int i = 0; i < particles.size(); ++i) {
+        const float depth = unitNormal.dot(this->position - particles.getPosition(i));
+        if (depth > 0.0f) {
+            projectParticle(previousPosition.row(i).transpose(), unitNormal, depth, coefFriction, i, particles);
         }
     }
 }
 
+float PlaneTerrain::signedDistance(const Eigen::Vector3f& point) const {
+    return this->normal.normalized().dot(point - this->position);
+}
+
 // SphereTerrain //
 
 SphereTerrain::SphereTerrain() { modelMatrix = util::translate(position) * util::scale(radius, radius, radius); }
@@ -76,36 +239,29 @@ SphereTerrain::SphereTerrain() { modelMatrix = util::translate(position) * util:
 TerrainType SphereTerrain::getType() { return TerrainType::Sphere; }
 
 void SphereTerrain::handleCollision(const float delta_T, Cube& cube) {
-    constexpr float eEPSILON = 0.01f;
-    constexpr float coefResist = 0.8f;
     constexpr float coefFriction = 0.3f;
-    
-    Eigen::Vector3f normal = Eigen::Vector3f::Zero();
-    
-    std::vector<simulation::Particle>* particles = cube.getParticlePointer();
-    for (int i = 0; i < particles->size(); ++i) {
-        normal = ((*particles)[i].getPosition() - this->position).normalized();
-        if (fabs(normal.dot(this->position - (*particles)[i].getPosition())) < eEPSILON + radius &&
-            normal.dot((*particles)[i].getVelocity()) < 0) {
-            Eigen::Vector3f vn = (*particles)[i].getVelocity().dot(normal) / (normal).norm() * normal;
-            Eigen::Vector3f vt = (*particles)[i].getVelocity() - vn;
-
-            (*particles)[i].setPosition((*particles)[i].getPosition() + normal * eEPSILON);
-            (*particles)[i].setVelocity(-coefResist * vn + vt);
-
-            Eigen::Vector3f fc = Eigen::Vector3f::Zero();
-            Eigen::Vector3f ff = Eigen::Vector3f::Zero();
-
-            if (normal.dot((*particles)[i].getForce()) < 0) {
-                fc = -(normal.dot((*particles)[i].getForce())) * normal;
-                ff = -coefFriction * (-normal.dot((*particles)[i].getForce())) * vt;
-            }
+    collideSphere(this->position, radius, false, coefFriction, cube.getParticles());
+}
+
 
-            (*particles)[i].addForce(fc + ff);
+void SphereTerrain::projectContact(const Eigen::MatrixX3f& previousPosition, Cube& cube) {
+    constexpr float coefFriction = 0.3f;
+
+    ParticleStore& particles = cube.getParticles();
+    for (int i = 0; i < particles.size(); ++i) {
+        const Eigen::Vector3f offset = particles.getPosition(i) - this->position;
+        const float distance = offset.norm();
+        if (distance < radius && distance > 0.0f) {
+            projectParticle(previousPosition.row(i).transpose(), offset / distance, radius - distance, coefFriction, i,
+                            particles);
         }
     }
 }
 
+float SphereTerrain::signedDistance(const Eigen::Vector3f& point) const {
+    return (point - this->position).norm() - radius;
+}
+
 // BowlTerrain //
 
 BowlTerrain::BowlTerrain() { modelMatrix = util::translate(position) * util::scale(radius, radius, radius); }
@@ -113,35 +269,31 @@ BowlTerrain::BowlTerrain() { modelMatrix = util::translate(position) * util::sca
 TerrainType BowlTerrain::getType() { return TerrainType::Bowl; }
 
 void BowlTerrain::handleCollision(const float delta_T, Cube& cube) {
-    constexpr float eEPSILON = 0.01f;
-    constexpr float coefResist = 0.8f;
     constexpr float coefFriction = 0.3f;
-    Eigen::Vector3f normal = Eigen::Vector3f::Zero();
-
-    std::vector<simulation::Particle>* particles = cube.getParticlePointer();
-    for (int i = 0; i < particles->size(); ++i) {
-        normal = (this->position - (*particles)[i].getPosition()).normalized();
-        if (fabs(normal.dot(this->position - (*particles)[i].getPosition())) > radius + eEPSILON &&
-            normal.dot((*particles)[i].getVelocity()) < 0) {
-            Eigen::Vector3f vn = (*particles)[i].getVelocity().dot(normal) / (normal).norm() * normal;
-            Eigen::Vector3f vt = (*particles)[i].getVelocity() - vn;
-
-            (*particles)[i].setPosition((*particles)[i].getPosition() + normal * eEPSILON);
-            (*particles)[i].setVelocity(-coefResist * vn + vt);
+    collideSphere(this->position, radius, true, coefFriction, cube.getParticles());
+}
 
-            Eigen::Vector3f fc = Eigen::Vector3f::Zero();
-            Eigen::Vector3f ff = Eigen::Vector3f::Zero();
 
-            if (normal.dot((*particles)[i].getForce()) < 0) {
-                fc = -(normal.dot((*particles)[i].getForce())) * normal;
-                ff = -coefFriction * (-normal.dot((*particles)[i].getForce())) * vt;
-            }
+void BowlTerrain::projectContact(const Eigen::MatrixX3f& previousPosition, Cube& cube) {
+    constexpr float coefFriction = 0.3f;
 
-            (*particles)[i].addForce(fc + ff);
+    ParticleStore& particles = cube.getParticles();
+    for (int i = 0; i < particles.size(); ++i) {
+        const Eigen::Vector3f offset = this->position - particles.getPosition(i);
+        const float distance = offset.norm();
+        // particles stay inside the bowl, the normal points back to its center
+        if (distance > radius) {
+            projectParticle(previousPosition.row(i).transpose(), offset / distance, distance - radius, coefFriction, i,
+                            particles);
         }
     }
 }
 
+float BowlTerrain::signedDistance(const Eigen::Vector3f& point) const {
+    // the inside of the bowl is free space
+    return radius - (point - this->position).norm();
+}
+
 // TiltedPlaneTerrain //
 
 TiltedPlaneTerrain::TiltedPlaneTerrain() { modelMatrix = util::rotateDegree(0, 0, -45) * util::scale(60, 1, 60); }
@@ -150,28 +302,177 @@ TerrainType TiltedPlaneTerrain::getType() { return TerrainType::TiltedPlane; }
 
 void TiltedPlaneTerrain::handleCollision(const float delta_T, Cube& cube) {
     constexpr float eEPSILON = 0.01f;
-    constexpr float coefResist = 0.8f;
     constexpr float coefFriction = 0.3f;
-   
-    std::vector<simulation::Particle>* particles = cube.getParticlePointer();
-    for (int i = 0; i < particles->size(); ++i) {
-        if (fabs(this->normal.dot(this->position - (*particles)[i].getPosition())) < eEPSILON &&
-            this->normal.dot((*particles)[i].getVelocity()) < 0) {
-            Eigen::Vector3f vn = (*particles)[i].getVelocity().dot(this->normal) / (this->normal).norm() * this->normal;
-            Eigen::Vector3f vt = (*particles)[i].getVelocity() - vn;
-
-            (*particles)[i].setPosition((*particles)[i].getPosition() + this->normal * eEPSILON * 0.1);
-            (*particles)[i].setVelocity(-coefResist * vn + vt);
-
-            Eigen::Vector3f fc = Eigen::Vector3f::Zero();
-            Eigen::Vector3f ff = Eigen::Vector3f::Zero();
-
-            if (this->normal.dot((*particles)[i].getForce()) < 0) {
-                fc = -(this->normal.dot((*particles)[i].getForce())) * this->normal;
-                ff = -coefFriction * (-this->normal.dot((*particles)[i].getForce())) * vt;
+    // a tenth of the lift, the normal is not a unit vector
+    collidePlane(this->position, this->normal, 0.1f * eEPSILON, coefFriction, cube.getParticles());
+}
+
+
+void TiltedPlaneTerrain::projectContact(const Eigen::MatrixX3f& previousPosition, Cube& cube) {
+    constexpr float coefFriction = 0.3f;
+    const Eigen::Vector3f unitNormal = this->normal.normalized();
+
+    ParticleStore& particles = cube.getParticles();
+    for (int i = 0; i < particles.size(); ++i) {
+        const float depth = unitNormal.dot(this->position - particles.getPosition(i));
+        if (depth > 0.0f) {
+            projectParticle(previousPosition.row(i).transpose(), unitNormal, depth, coefFriction, i, particles);
+        }
+    }
+}
+
+float TiltedPlaneTerrain::signedDistance(const Eigen::Vector3f& point) const {
+    return this->normal.normalized().dot(point - this->position);
+}
+
+// SDFTerrain //
+
+SDFTerrain::SDFTerrain(const Terrain& source, const Eigen::AlignedBox3f& bounds, const float cellSize,
+                       const float friction)
+    : origin(bounds.min()), inverseCellSize(1.0f / cellSize), friction(friction) {
+    nodeCount = (bounds.sizes() * inverseCellSize).array().ceil().cast<int>() + 1;
+    samples.resize(static_cast<size_t>(nodeCount.prod()));
+    // central differences a quarter cell wide, exact for the analytic planes and spheres
+    const float step = 0.25f * cellSize;
+    util::ThreadPool::getInstance().parallelFor(0, nodeCount[2], 1, [&](const int begin, const int end) {
+        for (int k = begin; k < end; ++k) {
+            for (int j = 0; j < nodeCount[1]; ++j) {
+                for (int i = 0; i < nodeCount[0]; ++i) {
+                    const Eigen::Vector3f node = origin + cellSize * Eigen::Vector3f(i, j, k);
+                    Eigen::Vector3f gradient;
+                    for (int axis = 0; axis < 3; ++axis) {
+                        const Eigen::Vector3f offset = step * Eigen::Vector3f::Unit(axis);
+                        gradient[axis] =
+                            (source.signedDistance(node + offset) - source.signedDistance(node - offset)) / (2 * step);
+                    }
+                    Eigen::Vector4f& value = samples[(k * nodeCount[1] + j) * nodeCount[0] + i];
+                    value << source.signedDistance(node), gradient;
+                }
             }
+        }
+    });
+}
+
+TerrainType SDFTerrain::getType() { return TerrainType::SDF; }
+
+Eigen::Vector4f SDFTerrain::sample(const Eigen::Vector3f& point) const {
+    // clamp into the grid, the last cell is interpolated with a fraction of one
+    const Eigen::Array3f grid = ((point - origin) * inverseCellSize)
+                                    .array()
+                                    .max(0.0f)
+                                    .min((nodeCount.array() - 1).cast<float>());
+    const Eigen::Array3i cell = grid.floor().cast<int>().min(nodeCount.array() - 2);
+    const Eigen::Array3f t = grid - cell.cast<float>();
+
+    const int stride[3] = {1, nodeCount[0], nodeCount[0] * nodeCount[1]};
+    const Eigen::Vector4f* corner = samples.data() + cell[0] + cell[1] * stride[1] + cell[2] * stride[2];
+    const Eigen::Vector4f x00 = corner[0] + t[0] * (corner[1] - corner[0]);
+    const Eigen::Vector4f x10 = corner[stride[1]] + t[0] * (corner[stride[1] + 1] - corner[stride[1]]);
+    const Eigen::Vector4f x01 = corner[stride[2]] + t[0] * (corner[stride[2] + 1] - corner[stride[2]]);
+    const Eigen::Vector4f x11 =
+        corner[stride[1] + stride[2]] + t[0] * (corner[stride[1] + stride[2] + 1] - corner[stride[1] + stride[2]]);
+    const Eigen::Vector4f y0 = x00 + t[1] * (x10 - x00);
+    const Eigen::Vector4f y1 = x01 + t[1] * (x11 - x01);
+    return y0 + t[2] * (y1 - y0);
+}
+
+float SDFTerrain::signedDistance(const Eigen::Vector3f& point) const { return sample(point)[0]; }
+
+void SDFTerrain::handleCollision(const float delta_T, Cube& cube) {
+    ParticleStore& particles = cube.getParticles();
+    for (int i = 0; i < particles.size(); ++i) {
+        const Eigen::Vector4f value = sample(particles.getPosition(i));
+        collideParticle(value[0], value.tail<3>().normalized(), friction, i, particles);
+    }
+}
+
+void SDFTerrain::projectContact(const Eigen::MatrixX3f& previousPosition, Cube& cube) {
+    ParticleStore& particles = cube.getParticles();
+    for (int i = 0; i < particles.size(); ++i) {
+        const Eigen::Vector4f value = sample(particles.getPosition(i));
+        if (value[0] < 0.0f) {
+            projectParticle(previousPosition.row(i).transpose(), value.tail<3>().normalized(), -value[0], friction, i,
+                            particles);
+        }
+    }
+}
+
+// HeightfieldTerrain //
+
+HeightfieldTerrain::HeightfieldTerrain(const util::Image& image, const Eigen::Vector3f& position, const float extent,
+                                       const float heightScale)
+    : position(position),
+      cellSize(extent / (image.getWidth() - 1)),
+      inverseCellSize((image.getWidth() - 1) / extent),
+      width(image.getWidth()),
+      depth(image.getHeight()),
+      tileColumns((image.getWidth() + tile - 1) / tile) {
+    if (width < 2 || depth < 2) throw std::invalid_argument("HeightfieldTerrain : image must be at least 2 x 2");
+    const int tileRows = (depth + tile - 1) / tile;
+    heights.assign(static_cast<size_t>(tileColumns) * tileRows * tile * tile, 0.0f);
+    const int channels = image.getChannels();
+    for (int j = 0; j < depth; ++j) {
+        for (int i = 0; i < width; ++i) {
+            heights[nodeIndex(i, j)] = heightScale / 255.0f * image.data()[(j * width + i) * channels];
+        }
+    }
+    modelMatrix = util::translate(position) * util::scale(extent, 1.0f, cellSize * (depth - 1));
+}
+
+TerrainType HeightfieldTerrain::getType() { return TerrainType::Heightfield; }
+
+float HeightfieldTerrain::sample(const float x, const float z, Eigen::Vector3f& normal) const {
+    // node coordinates relative to the corner, clamped so the border heights extend outward
+    const float gridX = std::min(std::max((x - position[0]) * inverseCellSize + 0.5f * (width - 1), 0.0f),
+                                 static_cast<float>(width - 1));
+    const float gridZ = std::min(std::max((z - position[2]) * inverseCellSize + 0.5f * (depth - 1), 0.0f),
+                                 static_cast<float>(depth - 1));
+    const int i = std::min(static_cast<int>(gridX), width - 2);
+    const int j = std::min(static_cast<int>(gridZ), depth - 2);
+    const float tx = gridX - i;
+    const float tz = gridZ - j;
+
+    const float h00 = heights[nodeIndex(i, j)];
+    const float h10 = heights[nodeIndex(i + 1, j)];
+    const float h01 = heights[nodeIndex(i, j + 1)];
+    const float h11 = heights[nodeIndex(i + 1, j + 1)];
+    const float slopeX = ((h10 - h00) * (1.0f - tz) + (h11 - h01) * tz) * inverseCellSize;
+    const float slopeZ = ((h01 - h00) * (1.0f - tx) + (h11 - h10) * tx) * inverseCellSize;
+    normal = Eigen::Vector3f(-slopeX, 1.0f, -slopeZ).normalized();
+    const float h0 = h00 + tx * (h10 - h00);
+    const float h1 = h01 + tx * (h11 - h01);
+    return h0 + tz * (h1 - h0);
+}
+
+float HeightfieldTerrain::signedDistance(const Eigen::Vector3f& point) const {
+    Eigen::Vector3f normal;
+    const float height = sample(point[0], point[2], normal);
+    // vertical gap projected on the normal, exact where the surface is locally flat
+    return (point[1] - position[1] - height) * normal[1];
+}
+
+void HeightfieldTerrain::handleCollision(const float delta_T, Cube& cube) {
+    constexpr float coefFriction = 0.7f;
+
+    ParticleStore& particles = cube.getParticles();
+    for (int i = 0; i < particles.size(); ++i) {
+        const Eigen::Vector3f point = particles.getPosition(i);
+        Eigen::Vector3f normal;
+        const float height = sample(point[0], point[2], normal);
+        collideParticle((point[1] - position[1] - height) * normal[1], normal, coefFriction, i, particles);
+    }
+}
+
+void HeightfieldTerrain::projectContact(const Eigen::MatrixX3f& previousPosition, Cube& cube) {
+    constexpr float coefFriction = 0.7f;
 
-            (*particles)[i].addForce(fc + ff);
+    ParticleStore& particles = cube.getParticles();
+    for (int i = 0; i < particles.size(); ++i) {
+        const Eigen::Vector3f point = particles.getPosition(i);
+        Eigen::Vector3f normal;
+        const float penetration = (position[1] + sample(point[0], point[2], normal) - point[1]) * normal[1];
+        if (penetration > 0.0f) {
+            projectParticle(previousPosition.row(i).transpose(), normal, penetration, coefFriction, i, particles);
         }
     }
 }
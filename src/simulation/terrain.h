@@ -1,30 +1,40 @@
 #pragma once
 #include <memory>
+#include <vector>
 
 #include "Eigen/Dense"
 
+#include "../util/alignedAllocator.h"
+#include "../util/image.h"
 #include "cube.h"
 
 namespace simulation {
 class Terrain;
 
-enum class TerrainType : char { Plane, Sphere, Bowl, TiltedPlane };
+enum class TerrainType : char { Plane, Sphere, Bowl, TiltedPlane, SDF, Heightfield };
 
 class TerrainFactory final {
  public:
     // no instance, only static usage
     TerrainFactory() = delete;
     static std::unique_ptr<Terrain> CreateTerrain(TerrainType type);
+    // sample the analytic terrain of type source into a TerrainType::SDF covering the region cubes move in
+    static std::unique_ptr<Terrain> CreateSDFTerrain(TerrainType source);
 };
 
 // a virtual class
 class Terrain {
  public:
     virtual ~Terrain() = default;
-    Eigen::Matrix4f getModelMatrix();
+    Eigen::Matrix4f getModelMatrix() const;
 
     virtual TerrainType getType() = 0;
     virtual void handleCollision(const float delta_T, Cube& cube) = 0;
+    // Position based contact: push every particle that penetrates the terrain back onto its surface and apply
+    // Coulomb friction to the tangential part of its displacement since previousPosition (particle count x 3).
+    virtual void projectContact(const Eigen::MatrixX3f& previousPosition, Cube& cube) = 0;
+    // distance from point to the surface, negative inside the solid
+    virtual float signedDistance(const Eigen::Vector3f& point) const = 0;
 
  protected:
     Eigen::Matrix4f modelMatrix = Eigen::Matrix4f::Identity();
@@ -38,6 +48,8 @@ class PlaneTerrain final : public Terrain {
 
     TerrainType getType() override;
     void handleCollision(const float delta_T, Cube& cube) override;
+    void projectContact(const Eigen::MatrixX3f& previousPosition, Cube& cube) override;
+    float signedDistance(const Eigen::Vector3f& point) const override;
 
  private:
     Eigen::Vector3f position = Eigen::Vector3f(0.0f, -1.0f, 0.0f);
@@ -52,6 +64,8 @@ class SphereTerrain final : public Terrain {
 
     TerrainType getType() override;
     void handleCollision(const float delta_T, Cube& cube) override;
+    void projectContact(const Eigen::MatrixX3f& previousPosition, Cube& cube) override;
+    float signedDistance(const Eigen::Vector3f& point) const override;
 
  private:
     Eigen::Vector3f position = Eigen::Vector3f(0.0f, -1.0f, 0.0f);
@@ -67,6 +81,8 @@ class BowlTerrain final : public Terrain {
 
     TerrainType getType() override;
     void handleCollision(const float delta_T, Cube& cube) override;
+    void projectContact(const Eigen::MatrixX3f& previousPosition, Cube& cube) override;
+    float signedDistance(const Eigen::Vector3f& point) const override;
 
  private:
     Eigen::Vector3f position = Eigen::Vector3f(2.0f, 7.0f, 1.0f);
@@ -82,9 +98,82 @@ class TiltedPlaneTerrain final : public Terrain {
 
     TerrainType getType() override;
     void handleCollision(const float delta_T, Cube& cube) override;
+    void projectContact(const Eigen::MatrixX3f& previousPosition, Cube& cube) override;
+    float signedDistance(const Eigen::Vector3f& point) const override;
 
  private:
     Eigen::Vector3f position = Eigen::Vector3f(0.0, 0.0, 0.0);
     Eigen::Vector3f normal = Eigen::Vector3f(1.0, 1.0, 0.0);
 };
+
+// Ground whose height is read from a grayscale image, black pixels at position.y and white ones heightScale higher.
+// Pixel columns run along x and rows along z, the image spans extent meters along x, centered on position.
+// Heights are stored in tile x tile blocks so the four nodes of a bilinear lookup, and those of nearby particles,
+// share cache lines. Outside the image the border heights extend outward.
+class HeightfieldTerrain final : public Terrain {
+ public:
+    friend class TerrainFactory;
+
+    HeightfieldTerrain(const util::Image& image, const Eigen::Vector3f& position, const float extent,
+                       const float heightScale);
+
+    TerrainType getType() override;
+    void handleCollision(const float delta_T, Cube& cube) override;
+    void projectContact(const Eigen::MatrixX3f& previousPosition, Cube& cube) override;
+    float signedDistance(const Eigen::Vector3f& point) const override;
+
+    // nodes along x and along z
+    int getWidth() const { return width; }
+    int getDepth() const { return depth; }
+    // height of node (i, j) above position.y
+    float getNodeHeight(const int i, const int j) const { return heights[nodeIndex(i, j)]; }
+    // height above position.y and unit normal of the surface above world point (x, z)
+    float sample(const float x, const float z, Eigen::Vector3f& normal) const;
+
+ private:
+    static constexpr int tile = 8;
+
+    Eigen::Vector3f position;
+    float cellSize;
+    float inverseCellSize;
+    int width;
+    int depth;
+    int tileColumns;
+    std::vector<float> heights;  // tile after tile, row-major inside a tile
+
+    int nodeIndex(const int i, const int j) const {
+        return ((j / tile) * tileColumns + i / tile) * tile * tile + (j % tile) * tile + i % tile;
+    }
+};
+
+// Any terrain sampled once into a regular grid holding the signed distance and its gradient at every node.
+// Collision then costs one trilinear lookup per particle whatever the source shape is. Points outside the grid
+// read the value of the nearest boundary point.
+class SDFTerrain final : public Terrain {
+ public:
+    friend class TerrainFactory;
+
+    // sample source over bounds with cubic cells of cellSize, friction is the Coulomb coefficient of the surface
+    SDFTerrain(const Terrain& source, const Eigen::AlignedBox3f& bounds, const float cellSize, const float friction);
+
+    TerrainType getType() override;
+    // type of the terrain that was sampled, Plane unless built by TerrainFactory::CreateSDFTerrain
+    TerrainType getSourceType() const { return sourceType; }
+    void handleCollision(const float delta_T, Cube& cube) override;
+    void projectContact(const Eigen::MatrixX3f& previousPosition, Cube& cube) override;
+    float signedDistance(const Eigen::Vector3f& point) const override;
+
+ private:
+    using SampleArray = std::vector<Eigen::Vector4f, util::AlignedAllocator<Eigen::Vector4f>>;
+
+    Eigen::Vector3f origin;
+    Eigen::Vector3i nodeCount;
+    float inverseCellSize;
+    float friction;
+    TerrainType sourceType = TerrainType::Plane;
+    SampleArray samples;  // distance followed by the gradient, x fastest then y then z
+
+    // interpolated distance (first coefficient) and gradient (last three)
+    Eigen::Vector4f sample(const Eigen::Vector3f& point) const;
+};
 }  // namespace simulation
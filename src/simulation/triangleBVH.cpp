@@ -0,0 +1,117 @@
+#include "triangleBVH.h"
+
+#include <algorithm>
+#include <numeric>
+
+namespace simulation {
+void TriangleBVH::build(const int *indices, const int triangleCount, const ParticleStore &particles) {
+    triangles.assign(indices, indices + 3 * triangleCount);
+    order.resize(triangleCount);
+    std::iota(order.begin(), order.end(), 0);
+    std::vector<Eigen::Vector3f> centroids(triangleCount);
+    for (int t = 0; t < triangleCount; ++t) {
+        centroids[t] = (particles.getPosition(triangles[3 * t]) + particles.getPosition(triangles[3 * t + 1]) +
+                        particles.getPosition(triangles[3 * t + 2])) /
+                       3.0f;
+    }
+    nodes.clear();
+    if (triangleCount == 0) return;
+    nodes.reserve(2 * (triangleCount / leafSize + 1));
+    nodes.emplace_back();
+    nodes[0].first = 0;
+    nodes[0].count = triangleCount;
+    split(0, centroids);
+    refit(particles, 0.0f);
+}
+
+void TriangleBVH::split(const int nodeIdx, const std::vector<Eigen::Vector3f> &centroids) {
+    const int first = nodes[nodeIdx].first;
+    const int count = nodes[nodeIdx].count;
+    if (count <= leafSize) return;
+
+    // split at the median centroid along the axis where centroids spread the most
+    Eigen::AlignedBox3f bound;
+    for (int i = first; i < first + count; ++i) bound.extend(centroids[order[i]]);
+    int axis = 0;
+    bound.sizes().maxCoeff(&axis);
+    const auto begin = order.begin() + first;
+    const auto middle = begin + count / 2;
+    std::nth_element(begin, middle, begin + count,
+                     [&centroids, axis](const int a, const int b) { return centroids[a][axis] < centroids[b][axis]; });
+
+    const int left = static_cast<int>(nodes.size());
+    nodes.emplace_back();
+    nodes.emplace_back();
+    nodes[left].first = first;
+    nodes[left].count = count / 2;
+    nodes[left + 1].first = first + count / 2;
+    nodes[left + 1].count = count - count / 2;
+    nodes[nodeIdx].first = left;
+    nodes[nodeIdx].count = 0;
+    split(left, centroids);
+    split(left + 1, centroids);
+}
+
+void TriangleBVH::refit(const ParticleStore &particles, const float margin) {
+    const Eigen::Vector3f grow = Eigen::Vector3f::Constant(margin);
+    // children come after their parents, so a reverse sweep visits them first
+    for (int n = static_cast<int>(nodes.size()) - 1; n >= 0; --n) {
+        Node &node = nodes[n];
+        node.box.setEmpty();
+        if (node.count > 0) {
+            for (int i = node.first; i < node.first + node.count; ++i) {
+                const int *vertex = getTriangle(order[i]);
+                for (int v = 0; v < 3; ++v) node.box.extend(particles.getPosition(vertex[v]));
+            }
+            node.box.min() -= grow;
+            node.box.max() += grow;
+        } else {
+            node.box.extend(nodes[node.first].box).extend(nodes[node.first + 1].box);
+        }
+    }
+}
+
+Eigen::Vector3f closestPointWeights(const Eigen::Vector3f &p, const Eigen::Vector3f &a, const Eigen::Vector3f &b,
+                                    const Eigen::Vector3f &c) {
+    // Voronoi region classification of Ericson, "Real-Time Collision Detection", section 5.1.5
+    const Eigen::Vector3f ab = b - a;
+    const Eigen::Vector3f ac = c - a;
+    const Eigen::Vector3f ap = p - a;
+    const float d1 = ab.dot(ap);
+    const float d2 = ac.dot(ap);
+    if (d1 <= 0.0f && d2 <= 0.0f) return Eigen::Vector3f(1.0f, 0.0f, 0.0f);
+
+    const Eigen::Vector3f bp = p - b;
+    const float d3 = ab.dot(bp);
+    const float d4 = ac.dot(bp);
+    if (d3 >= 0.0f && d4 <= d3) return Eigen::Vector3f(0.0f, 1.0f, 0.0f);
+
+    const float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+        const float v = d1 / (d1 - d3);
+        return Eigen::Vector3f(1.0f - v, v, 0.0f);
+    }
+
+    const Eigen::Vector3f cp = p - c;
+    const float d5 = ab.dot(cp);
+    const float d6 = ac.dot(cp);
+    if (d6 >= 0.0f && d5 <= d6) return Eigen::Vector3f(0.0f, 0.0f, 1.0f);
+
+    const float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+        const float w = d2 / (d2 - d6);
+        return Eigen::Vector3f(1.0f - w, 0.0f, w);
+    }
+
+    const float va = d3 * d6 - d5 * d4;
+    if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) {
+        const float w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+        return Eigen::Vector3f(0.0f, 1.0f - w, w);
+    }
+
+    const float denominator = 1.0f / (va + vb + vc);
+    const float v = vb * denominator;
+    const float w = vc * denominator;
+    return Eigen::Vector3f(1.0f - v - w, v, w);
+}
+}  // namespace simulation
@@ -0,0 +1,74 @@
+#pragma once
+#include <vector>
+
+#include "Eigen/Dense"
+
+#include "particleStore.h"
+
+namespace simulation {
+// Bounding volume hierarchy of axis aligned boxes over a fixed triangle mesh whose vertices move.
+// The tree is built once from a median split of the triangle centroids; afterwards refit() only recomputes the
+// boxes bottom-up, which is linear in the triangle count. The tree gets looser as the mesh deforms, but queries
+// stay correct since they only rely on the boxes enclosing their triangles.
+class TriangleBVH {
+ public:
+    //==========================================
+    //  getter
+    //==========================================
+
+    int getTriangleCount() const { return static_cast<int>(triangles.size()) / 3; }
+    // vertex indices of triangle t, in the order given to build
+    const int *getTriangle(const int t) const { return triangles.data() + 3 * t; }
+
+    //==========================================
+    //  method
+    //==========================================
+
+    // build the tree over triangleCount triangles, triangle t having vertices indices[3t], indices[3t + 1] and
+    // indices[3t + 2] in particles
+    void build(const int *indices, const int triangleCount, const ParticleStore &particles);
+    // recompute every box from the current positions, boxes are grown by margin on each side
+    void refit(const ParticleStore &particles, const float margin);
+    // call visit(t) for every triangle t whose box contains point, safe to call concurrently
+    template <typename Function>
+    void query(const Eigen::Vector3f &point, const Function &visit) const {
+        if (nodes.empty()) return;
+        int stack[maxDepth];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const Node &node = nodes[stack[--top]];
+            if (!node.box.contains(point)) continue;
+            if (node.count > 0) {
+                for (int i = node.first; i < node.first + node.count; ++i) visit(order[i]);
+            } else {
+                stack[top++] = node.first;
+                stack[top++] = node.first + 1;
+            }
+        }
+    }
+
+ private:
+    // triangles per leaf
+    static constexpr int leafSize = 4;
+    // bound of the traversal stack, a median split tree this deep holds billions of triangles
+    static constexpr int maxDepth = 64;
+
+    struct Node {
+        Eigen::AlignedBox3f box;
+        int first = 0;  // first entry of order for a leaf, index of the left child otherwise
+        int count = 0;  // number of triangles of a leaf, 0 for an inner node whose children are first, first + 1
+    };
+
+    std::vector<Node> nodes;  // children always come after their parent
+    std::vector<int> order;   // triangle indices grouped by leaf
+    std::vector<int> triangles;
+
+    void split(const int nodeIdx, const std::vector<Eigen::Vector3f> &centroids);
+};
+
+// barycentric weights of the point of triangle abc closest to p, the point being weights[0] a + weights[1] b +
+// weights[2] c
+Eigen::Vector3f closestPointWeights(const Eigen::Vector3f &p, const Eigen::Vector3f &a, const Eigen::Vector3f &b,
+                                    const Eigen::Vector3f &c);
+}  // namespace simulation
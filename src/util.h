@@ -8,4 +8,10 @@ This is the header for external usage of output utility.
 #include "util/clock.h"
 #include "util/exporter.h"
 #include "util/filesystem.h"
+#include "util/frameQueue.h"
 #include "util/helper.h"
+#include "util/image.h"
+#include "util/mappedFile.h"
+#include "util/threadPool.h"
+#include "util/trajectory.h"
+#include "util/tripleBuffer.h"
@@ -1,92 +1,119 @@
 #include "exporter.h"
 
+#include <algorithm>
 #include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
 
 #include "filesystem.h"
 #include "glad/glad.h"
+#include "threadPool.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
 namespace util {
-std::atomic<int> Writer::pictureCounter(-1);
-std::atomic<int> Writer::filenameFormattingThreads(0);
-
-void Writer::infiniteLoop(int width, int height) {
-    imageBuffer.resize(width * height * 3);
-    char buf[32] = {};
-    while (true) {
-        {
-            std::unique_lock<std::mutex> lock(notifyNew);
-            cvNew.wait(lock, [this] { return hasData.load(); });
+namespace {
+constexpr char frameMarker[] = "FRAME\n";
+constexpr size_t frameMarkerSize = sizeof(frameMarker) - 1;
+
+unsigned char clampByte(const int value) { return static_cast<unsigned char>(std::min(std::max(value, 0), 255)); }
+
+// Convert the chroma rows [begin, end) of a width * height RGB image with rows from bottom to top into the planes
+// of YUV 4:2:0 with rows from top to bottom, so that the flip costs nothing but the row addressing. Full range
+// BT.601 (JFIF) coefficients in 16 bits fixed point, chroma averages 2 * 2 pixels and repeats the last row and
+// column of odd sizes.
+void convertToYUV420(const unsigned char* rgb, const int width, const int height, const int begin, const int end,
+                     unsigned char* yuv) {
+    const int chromaWidth = (width + 1) / 2;
+    const int chromaHeight = (height + 1) / 2;
+    unsigned char* cbPlane = yuv + static_cast<size_t>(width) * height;
+    unsigned char* crPlane = cbPlane + static_cast<size_t>(chromaWidth) * chromaHeight;
+    for (int cy = begin; cy < end; ++cy) {
+        const int y0 = 2 * cy;
+        const int y1 = std::min(y0 + 1, height - 1);
+        const unsigned char* row0 = rgb + static_cast<size_t>(height - 1 - y0) * width * 3;
+        const unsigned char* row1 = rgb + static_cast<size_t>(height - 1 - y1) * width * 3;
+        unsigned char* luma0 = yuv + static_cast<size_t>(y0) * width;
+        unsigned char* luma1 = yuv + static_cast<size_t>(y1) * width;
+        for (int x = 0; x < width; ++x) {
+            const unsigned char* p0 = row0 + 3 * x;
+            const unsigned char* p1 = row1 + 3 * x;
+            luma0[x] = static_cast<unsigned char>((19595 * p0[0] + 38470 * p0[1] + 7471 * p0[2] + 32768) >> 16);
+            luma1[x] = static_cast<unsigned char>((19595 * p1[0] + 38470 * p1[1] + 7471 * p1[2] + 32768) >> 16);
         }
-        if (stop) break;
-        ++filenameFormattingThreads;
-        snprintf(buf, sizeof(buf), "./Screenshots/%03d.jpg", pictureCounter++);
-        --filenameFormattingThreads;
-        {
-            std::unique_lock<std::mutex> lock(bufferLock);
-            stbi_write_jpg(buf, width, height, 3, imageBuffer.data(), 80);
+        unsigned char* cb = cbPlane + static_cast<size_t>(cy) * chromaWidth;
+        unsigned char* cr = crPlane + static_cast<size_t>(cy) * chromaWidth;
+        for (int cx = 0; cx < chromaWidth; ++cx) {
+            const int x0 = 3 * (2 * cx);
+            const int x1 = 3 * std::min(2 * cx + 1, width - 1);
+            // sums of 4 pixels, the 1 / 4 goes into the shift
+            const int r = row0[x0] + row0[x1] + row1[x0] + row1[x1];
+            const int g = row0[x0 + 1] + row0[x1 + 1] + row1[x0 + 1] + row1[x1 + 1];
+            const int b = row0[x0 + 2] + row0[x1 + 2] + row1[x0 + 2] + row1[x1 + 2];
+            cb[cx] = clampByte(((-11059 * r - 21709 * g + 32768 * b + (1 << 17)) >> 18) + 128);
+            cr[cx] = clampByte(((32768 * r - 27439 * g - 5329 * b + (1 << 17)) >> 18) + 128);
         }
-        hasData.store(false);
-        cvFinish.notify_one();
     }
 }
 
-void Writer::write() {
-    if (pictureCounter.load() == -1) {
-        ++pictureCounter;
-        auto screenshotPath = fs::current_path() / "Screenshots";
-        if (!fs::exists(screenshotPath)) {
-            fs::create_directory(screenshotPath);
-        } else {
-            for (const auto& entry : fs::directory_iterator(screenshotPath)) {
-                fs::remove_all(entry.path());
-            }
-        }
-        return;
-    }
-    hasData.store(true);
-    cvNew.notify_one();
+// encode one frame of frames into ./Screenshots/<frame>.jpg
+void writeJPEG(FrameQueue& frames, const int width, const int height) {
+    // one pop per pushed frame, so there is one
+    FrameQueue::Frame* frame = frames.pop();
+    char buf[32] = {};
+    snprintf(buf, sizeof(buf), "./Screenshots/%06d.jpg", frame->number);
+    stbi_write_jpg(buf, width, height, 3, frame->pixels.data(), 80);
+    frames.release(frame);
 }
-
-void Writer::readCurrentPBO() {
-    {
-        std::unique_lock<std::mutex> lock(bufferLock);
-        cvFinish.wait(lock, [this] { return !hasData.load(); });
-    }
-    glGetBufferSubData(GL_PIXEL_PACK_BUFFER, 0, imageBuffer.size(), imageBuffer.data());
+}  // namespace
+
+VideoWriter::VideoWriter(const fs::path& filePath, FrameQueue& _frames, TaskGroup& _tasks, int _width, int _height,
+                         int framesPerSecond)
+    : frames(_frames), tasks(_tasks), width(_width), height(_height), failed(false), unwrittenFrames(0) {
+    file.open(filePath, std::ios::binary | std::ios::trunc);
+    if (!file) throw std::runtime_error("VideoWriter : cannot open " + filePath.string());
+    const std::string header = "YUV4MPEG2 W" + std::to_string(width) + " H" + std::to_string(height) + " F" +
+                               std::to_string(framesPerSecond) + ":1 Ip A1:1 C420jpeg\n";
+    file.write(header.data(), header.size());
+    const size_t chromaSize = static_cast<size_t>((width + 1) / 2) * ((height + 1) / 2);
+    output.resize(frameMarkerSize + static_cast<size_t>(width) * height + 2 * chromaSize);
+    std::memcpy(output.data(), frameMarker, frameMarkerSize);
 }
 
-Writer::Writer(int width, int height)
-    : stop(false), hasData(false), writerThread(&Writer::infiniteLoop, this, width, height) {}
-
-Writer::~Writer() { join(); }
-
-void Writer::join() {
-    if (writerThread.joinable()) {
-        hasData.store(true);
-        stop.store(true);
-        cvNew.notify_one();
-        writerThread.join();
-    }
+void VideoWriter::frameQueued() {
+    // The task that raises the count from 0 writes until it drops back to 0
+    if (unwrittenFrames.fetch_add(1, std::memory_order_acq_rel) == 0) tasks.run([this] { writeFrames(); });
 }
 
-int Writer::getPictureCounter() { return pictureCounter.load(); }
-
-void Writer::resetPictureCounter() {
-    while (filenameFormattingThreads != 0) {
-    }
-    pictureCounter.store(-1);
+void VideoWriter::writeFrames() {
+    // chroma rows per parallel chunk of the conversion
+    constexpr int grain = 16;
+    const int chromaHeight = (height + 1) / 2;
+    unsigned char* planes = output.data() + frameMarkerSize;
+    do {
+        // counted after its push, so the frame is there
+        FrameQueue::Frame* frame = frames.pop();
+        const unsigned char* rgb = frame->pixels.data();
+        ThreadPool::getInstance().parallelFor(0, chromaHeight, grain, [this, rgb, planes](int begin, int end) {
+            convertToYUV420(rgb, width, height, begin, end, planes);
+        });
+        frames.release(frame);
+        if (!file.write(reinterpret_cast<const char*>(output.data()), output.size())) failed.store(true);
+    } while (unwrittenFrames.fetch_sub(1, std::memory_order_acq_rel) > 1);
 }
 
 Exporter::Exporter() {
     stbi_flip_vertically_on_write(true);
-    glGenBuffers(2, pixelBuffer);
-    writer.reserve(threadCount);
-    printf("Using %d threads to write screenshot.\n", threadCount);
+    glGenBuffers(ringSize, pixelBuffer);
 }
 
-Exporter::~Exporter() { glDeleteBuffers(2, pixelBuffer); }
+Exporter::~Exporter() {
+    stopRecording();
+    glDeleteBuffers(ringSize, pixelBuffer);
+}
 
 void Exporter::resize(int screenWidth, int screenHeight) {
     if (screenWidth & 0b11) {
@@ -94,26 +121,115 @@ void Exporter::resize(int screenWidth, int screenHeight) {
     } else {
         glPixelStorei(GL_PACK_ALIGNMENT, 4);
     }
-    writer.resize(0);
+    stopRecording();
     width = screenWidth;
     height = screenHeight;
-    glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffer[0]);
-    glBufferData(GL_PIXEL_PACK_BUFFER, width * height * 3, nullptr, GL_STREAM_READ);
-    glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffer[1]);
-    glBufferData(GL_PIXEL_PACK_BUFFER, width * height * 3, nullptr, GL_STREAM_READ);
+    for (int i = 0; i < ringSize; ++i) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffer[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, width * height * 3, nullptr, GL_STREAM_READ);
+    }
     glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
-    for (int i = 0; i < threadCount; ++i) writer.emplace_back(std::make_unique<Writer>(width, height));
+}
+
+void Exporter::startRecording(ExportFormat _format, int framesPerSecond) {
+    stopRecording();
+    format = _format;
+    const auto screenshotPath = fs::current_path() / "Screenshots";
+    if (!fs::exists(screenshotPath)) {
+        fs::create_directory(screenshotPath);
+    } else if (format == ExportFormat::JPEG) {
+        for (const auto& entry : fs::directory_iterator(screenshotPath)) {
+            fs::remove_all(entry.path());
+        }
+    }
+    frameCounter = 0;
+    auto queue = std::make_unique<FrameQueue>(queueCapacity, static_cast<size_t>(width) * height * 3);
+    if (format == ExportFormat::Y4M) {
+        video = std::make_unique<VideoWriter>(screenshotPath / "video.y4m", *queue, encoders, width, height,
+                                              framesPerSecond);
+    }
+    frames = std::move(queue);
+}
+
+void Exporter::stopRecording() {
+    if (frames == nullptr) return;
+    // Frames still in flight are part of the recording
+    collectFrames(Collect::All);
+    encoders.wait();
+    if (video != nullptr && video->hasFailed()) printf("Failed to write the video, it is incomplete.\n");
+    video.reset();
+    lastStatistics = frames->getStatistics();
+    frames.reset();
 }
 
 void Exporter::outputScreenShot() {
-    glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffer[currentIndex]);
+    if (frames == nullptr) return;
+    collectFrames(Collect::Ready);
+    // Every slot in flight, the oldest frame has to make room
+    if (pendingCount == ringSize) collectFrames(Collect::Oldest);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffer[ringHead]);
     glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
-    currentIndex ^= 1;
-    glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffer[currentIndex]);
-    writer[currentWriter]->readCurrentPBO();
     glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
-    writer[currentWriter]->write();
-    (currentWriter += 1) %= threadCount;
+    fence[ringHead] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    ringHead = (ringHead + 1) % ringSize;
+    ++pendingCount;
+}
+
+FrameQueue::Statistics Exporter::getStatistics() const {
+    return frames != nullptr ? frames->getStatistics() : lastStatistics;
+}
+
+void Exporter::collectFrames(Collect mode) {
+    // Nanoseconds per blocking wait, repeated until the fence signals
+    constexpr GLuint64 waitTimeout = 1000000;
+    const size_t frameSize = static_cast<size_t>(width) * height * 3;
+    while (pendingCount > 0) {
+        const int slot = (ringHead - pendingCount + ringSize) % ringSize;
+        GLsync sync = static_cast<GLsync>(fence[slot]);
+        GLenum status;
+        if (mode != Collect::Ready) {
+            // The flush makes sure the fence reaches the GPU
+            do {
+                status = glClientWaitSync(sync, GL_SYNC_FLUSH_COMMANDS_BIT, waitTimeout);
+            } while (status == GL_TIMEOUT_EXPIRED);
+        } else {
+            status = glClientWaitSync(sync, 0, 0);
+            if (status == GL_TIMEOUT_EXPIRED) return;
+        }
+        // A failed wait leaves the content of the readback unknown, the frame is dropped
+        FrameQueue::Frame* frame = nullptr;
+        if (status != GL_WAIT_FAILED) {
+            // A frame stays in the ring while the queue is full, unless it has to make room
+            frame = frames->acquire();
+            if (frame == nullptr && mode == Collect::Ready) return;
+            while (frame == nullptr && mode == Collect::All) {
+                if (!ThreadPool::getInstance().runPendingTask()) std::this_thread::yield();
+                frame = frames->acquire();
+            }
+        }
+        if (frame != nullptr) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffer[slot]);
+            const void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, frameSize, GL_MAP_READ_BIT);
+            if (pixels != nullptr) {
+                std::memcpy(frame->pixels.data(), pixels, frameSize);
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            frame->number = frameCounter++;
+            frames->push(frame);
+            if (format == ExportFormat::Y4M) {
+                video->frameQueued();
+            } else {
+                encoders.run([queue = frames.get(), w = width, h = height] { writeJPEG(*queue, w, h); });
+            }
+        } else {
+            frames->drop();
+        }
+        glDeleteSync(sync);
+        fence[slot] = nullptr;
+        --pendingCount;
+        if (mode == Collect::Oldest) mode = Collect::Ready;
+    }
 }
 
 }  // namespace util
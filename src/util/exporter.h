@@ -1,51 +1,85 @@
 #pragma once
 #include <atomic>
-#include <condition_variable>
+#include <fstream>
 #include <memory>
-#include <mutex>
-#include <thread>
 #include <vector>
-namespace util {
-class Writer {
- private:
-    static std::atomic<int> pictureCounter;
-    static std::atomic<int> filenameFormattingThreads;
 
-    std::condition_variable cvNew, cvFinish;
-    std::mutex notifyNew, bufferLock;
+#include "filesystem.h"
+#include "frameQueue.h"
+#include "threadPool.h"
+namespace util {
+// JPEG writes one numbered image per frame into ./Screenshots, Y4M streams every frame into ./Screenshots/video.y4m
+enum class ExportFormat : char { JPEG, Y4M };
 
-    std::vector<unsigned char> imageBuffer;
-    std::atomic<bool> stop, hasData;
-    std::thread writerThread;
-    void infiniteLoop(int width, int height);
+// Streams the frames of a FrameQueue into one YUV4MPEG2 file as full range BT.601 YUV 4:2:0, which ffmpeg reads
+// directly. Every frame is converted on the thread pool, flipped upright on the way, and appended with a single
+// write. One task at a time writes, so the frames stay in order.
+class VideoWriter {
+ private:
+    FrameQueue& frames;
+    TaskGroup& tasks;
+    int width, height;
+    std::ofstream file;
+    std::atomic<bool> failed;
+    std::atomic<int> unwrittenFrames;  // pushed frames the writing task has not taken yet
+    std::vector<unsigned char> output;
+    void writeFrames();
 
  public:
-    Writer(int width, int height);
-    ~Writer();
-    static int getPictureCounter();
-    static void resetPictureCounter();
-    void write();
-    void readCurrentPBO();
-    void join();
+    // create filePath, throw std::runtime_error if it cannot be created
+    VideoWriter(const fs::path& filePath, FrameQueue& frames, TaskGroup& tasks, int width, int height,
+                int framesPerSecond);
+    VideoWriter(const VideoWriter&) = delete;
+    VideoWriter& operator=(const VideoWriter&) = delete;
+
+    // write the frame just pushed to frames, after the ones before it
+    void frameQueued();
+    bool hasFailed() const { return failed.load(); }
 };
+// Captures the default framebuffer into a ring of pixel buffers. Every readback is fenced, and a frame is mapped
+// into a free slot of the FrameQueue once its fence has signaled. Encoding runs as tasks on the process-wide
+// ThreadPool; when the encoders fall so far behind that both the queue and the ring are full, the oldest frame is
+// dropped and counted instead of stalling the render thread.
 class Exporter final {
  private:
     Exporter(const Exporter&) = delete;
     Exporter& operator=(const Exporter&) = delete;
     Exporter(Exporter&&) = delete;
 
+    static constexpr int ringSize = 4;
+    // frames of a recording that can wait for an encoder
+    static constexpr int queueCapacity = 8;
+
+    // Ready: the completed frames that have a free queue slot. Oldest: the oldest frame as well, dropped if no
+    // slot is free. All: every frame in flight, waiting for slots.
+    enum class Collect : char { Ready, Oldest, All };
+
     int width = 0, height = 0;
-    int threadCount = std::thread::hardware_concurrency() - 1;
-    int currentIndex = 0;
-    int currentWriter = 0;
-    unsigned int pixelBuffer[2] = {};
-    std::vector<std::unique_ptr<Writer>> writer;
+    int frameCounter = 0;  // number of the next frame
+    unsigned int pixelBuffer[ringSize] = {};
+    void* fence[ringSize] = {};  // GLsync of the readback into the pixel buffer
+    int ringHead = 0;            // slot the next frame is read into
+    int pendingCount = 0;        // frames in flight in the slots before ringHead
+    ExportFormat format = ExportFormat::JPEG;
+    std::unique_ptr<FrameQueue> frames;
+    FrameQueue::Statistics lastStatistics;  // of the last recording once it stopped
+    TaskGroup encoders;
+    std::unique_ptr<VideoWriter> video;
+
+    // Hand the frames whose readback has completed to the queue, oldest first.
+    void collectFrames(Collect mode);
 
  public:
     Exporter();
     ~Exporter();
+    // stops the recording, the next one captures frames at the new size
     void resize(int screenWidth, int screenHeight);
+    // Begin a recording of unlimited length, Y4M throws std::runtime_error if the video cannot be created.
+    void startRecording(ExportFormat _format, int framesPerSecond);
+    void stopRecording();
     void outputScreenShot();
+    // backpressure of the current recording, or of the last one
+    FrameQueue::Statistics getStatistics() const;
 };
 
 }  // namespace util
@@ -0,0 +1,117 @@
+#include "frameQueue.h"
+
+#include <stdexcept>
+
+namespace util {
+// FrameQueue::Ring
+
+FrameQueue::Ring::Ring(int capacity) {
+    size_t size = 1;
+    while (size < static_cast<size_t>(capacity)) size <<= 1;
+    cells = std::make_unique<Cell[]>(size);
+    mask = size - 1;
+    // cell i expects the enqueue at position i
+    for (size_t i = 0; i < size; ++i) cells[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+bool FrameQueue::Ring::push(Frame* frame) {
+    size_t position = enqueuePosition.load(std::memory_order_relaxed);
+    while (true) {
+        Cell& cell = cells[position & mask];
+        const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        const std::ptrdiff_t difference = static_cast<std::ptrdiff_t>(sequence - position);
+        if (difference == 0) {
+            if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                cell.frame = frame;
+                cell.sequence.store(position + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (difference < 0) {
+            // full, the cell still holds the value of the previous lap
+            return false;
+        } else {
+            position = enqueuePosition.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool FrameQueue::Ring::pop(Frame*& frame) {
+    size_t position = dequeuePosition.load(std::memory_order_relaxed);
+    while (true) {
+        Cell& cell = cells[position & mask];
+        const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        const std::ptrdiff_t difference = static_cast<std::ptrdiff_t>(sequence - (position + 1));
+        if (difference == 0) {
+            if (dequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                frame = cell.frame;
+                // free the cell for the enqueue of the next lap
+                cell.sequence.store(position + mask + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (difference < 0) {
+            // empty
+            return false;
+        } else {
+            position = dequeuePosition.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+// FrameQueue
+
+FrameQueue::FrameQueue(int capacity, size_t frameSize)
+    : frames(capacity > 0 ? capacity : throw std::invalid_argument("FrameQueue : capacity must be positive")),
+      freeFrames(capacity),
+      readyFrames(capacity) {
+    for (auto& frame : frames) {
+        frame.pixels.resize(frameSize);
+        freeFrames.push(&frame);
+    }
+}
+
+FrameQueue::Frame* FrameQueue::acquire() {
+    Frame* frame = nullptr;
+    return freeFrames.pop(frame) ? frame : nullptr;
+}
+
+void FrameQueue::push(Frame* frame) {
+    frame->queueTime = std::chrono::steady_clock::now();
+    queued.fetch_add(1, std::memory_order_relaxed);
+    // never full, the ring has room for every frame
+    readyFrames.push(frame);
+}
+
+void FrameQueue::drop() { dropped.fetch_add(1, std::memory_order_relaxed); }
+
+FrameQueue::Frame* FrameQueue::pop() {
+    Frame* frame = nullptr;
+    if (!readyFrames.pop(frame)) return nullptr;
+    queued.fetch_sub(1, std::memory_order_relaxed);
+    return frame;
+}
+
+void FrameQueue::release(Frame* frame) {
+    const long long latency = std::chrono::duration_cast<std::chrono::microseconds>(
+                                  std::chrono::steady_clock::now() - frame->queueTime)
+                                  .count();
+    latencySum.fetch_add(latency, std::memory_order_relaxed);
+    long long maxLatency = latencyMax.load(std::memory_order_relaxed);
+    while (latency > maxLatency && !latencyMax.compare_exchange_weak(maxLatency, latency)) {
+    }
+    encoded.fetch_add(1, std::memory_order_relaxed);
+    freeFrames.push(frame);
+}
+
+FrameQueue::Statistics FrameQueue::getStatistics() const {
+    Statistics statistics;
+    statistics.capacity = static_cast<int>(frames.size());
+    statistics.queued = queued.load(std::memory_order_relaxed);
+    statistics.encoded = encoded.load(std::memory_order_relaxed);
+    statistics.dropped = dropped.load(std::memory_order_relaxed);
+    if (statistics.encoded > 0) {
+        statistics.averageLatency = latencySum.load(std::memory_order_relaxed) / 1000.0 / statistics.encoded;
+    }
+    statistics.maxLatency = latencyMax.load(std::memory_order_relaxed) / 1000.0;
+    return statistics;
+}
+}  // namespace util
@@ -0,0 +1,73 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace util {
+// Bounded queue of preallocated frames from one producer to any number of consumers. Frames move between a free
+// ring and a ready ring, both lock-free (Vyukov's bounded MPMC queue), so handing a frame over never takes a lock
+// and never allocates. Nothing blocks; the producer schedules one consumer task per pushed frame.
+class FrameQueue final {
+ public:
+    struct Frame {
+        std::vector<unsigned char> pixels;
+        int number = 0;
+        std::chrono::steady_clock::time_point queueTime;
+    };
+    // backpressure of the queue since its creation, latencies in milliseconds from push() to release()
+    struct Statistics {
+        int capacity = 0;
+        int queued = 0;  // frames pushed and not yet popped
+        long long encoded = 0;
+        long long dropped = 0;
+        double averageLatency = 0.0;
+        double maxLatency = 0.0;
+    };
+
+    // capacity frames of frameSize bytes each
+    FrameQueue(int capacity, size_t frameSize);
+    FrameQueue(const FrameQueue&) = delete;
+    FrameQueue& operator=(const FrameQueue&) = delete;
+
+    // Producer side. acquire() returns a free frame, or nullptr while every frame is queued or being encoded;
+    // push() hands a filled frame to the consumers and drop() counts a frame that found no free one.
+    Frame* acquire();
+    void push(Frame* frame);
+    void drop();
+
+    // Consumer side. pop() returns the oldest ready frame, or nullptr if there is none; release() gives an
+    // encoded frame back to the producer.
+    Frame* pop();
+    void release(Frame* frame);
+
+    Statistics getStatistics() const;
+
+ private:
+    class Ring {
+     public:
+        explicit Ring(int capacity);
+        bool push(Frame* frame);
+        bool pop(Frame*& frame);
+
+     private:
+        struct Cell {
+            std::atomic<size_t> sequence;
+            Frame* frame;
+        };
+        std::unique_ptr<Cell[]> cells;
+        size_t mask;
+        // producers and consumers on separate cache lines
+        alignas(64) std::atomic<size_t> enqueuePosition{0};
+        alignas(64) std::atomic<size_t> dequeuePosition{0};
+    };
+
+    std::vector<Frame> frames;
+    Ring freeFrames, readyFrames;
+
+    std::atomic<int> queued{0};
+    std::atomic<long long> encoded{0}, dropped{0};
+    std::atomic<long long> latencySum{0}, latencyMax{0};  // microseconds
+};
+}  // namespace util
@@ -0,0 +1,19 @@
+#include "image.h"
+
+#include <stdexcept>
+#include <string>
+
+#define STBI_ONLY_PNG
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+namespace util {
+Image::Image(const fs::path& filePath, const int _channels) : pixels(nullptr, stbi_image_free) {
+    // stb_image keeps the flip as global state, gfx::Texture sets it before each of its loads
+    stbi_set_flip_vertically_on_load(false);
+    int fileChannels = 0;
+    pixels.reset(stbi_load(filePath.string().c_str(), &width, &height, &fileChannels, _channels));
+    if (pixels == nullptr) throw std::runtime_error("Image : cannot load " + filePath.string());
+    channels = _channels == 0 ? fileChannels : _channels;
+}
+}  // namespace util
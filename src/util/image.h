@@ -0,0 +1,25 @@
+#pragma once
+#include <memory>
+
+#include "filesystem.h"
+
+namespace util {
+// 8 bits per channel image decoded by stb_image, which this file compiles.
+class Image final {
+ public:
+    // load filePath converted to channels channels (0 keeps the file's own), throw std::runtime_error on failure
+    explicit Image(const fs::path& filePath, const int channels = 0);
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    int getChannels() const { return channels; }
+    // row-major pixels, rows from top to bottom
+    const unsigned char* data() const { return pixels.get(); }
+
+ private:
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    std::unique_ptr<unsigned char, void (*)(void*)> pixels;
+};
+}  // namespace util
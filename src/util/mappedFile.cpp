@@ -0,0 +1,67 @@
+#include "mappedFile.h"
+
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace util {
+#ifdef _WIN32
+MappedFile::MappedFile(const fs::path& filePath) {
+    fileHandle = CreateFileW(filePath.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                             FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (fileHandle == INVALID_HANDLE_VALUE) {
+        fileHandle = nullptr;
+        throw std::runtime_error("MappedFile : cannot open " + filePath.string());
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0) {
+        CloseHandle(fileHandle);
+        throw std::runtime_error("MappedFile : " + filePath.string() + " is empty");
+    }
+    length = static_cast<size_t>(fileSize.QuadPart);
+    mappingHandle = CreateFileMappingW(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mappingHandle != nullptr) {
+        mapping = static_cast<const unsigned char*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+    }
+    if (mapping == nullptr) {
+        if (mappingHandle != nullptr) CloseHandle(mappingHandle);
+        CloseHandle(fileHandle);
+        throw std::runtime_error("MappedFile : cannot map " + filePath.string());
+    }
+}
+
+MappedFile::~MappedFile() {
+    UnmapViewOfFile(mapping);
+    CloseHandle(mappingHandle);
+    CloseHandle(fileHandle);
+}
+#else
+MappedFile::MappedFile(const fs::path& filePath) {
+    const int descriptor = open(filePath.c_str(), O_RDONLY);
+    if (descriptor < 0) throw std::runtime_error("MappedFile : cannot open " + filePath.string());
+    struct stat status;
+    if (fstat(descriptor, &status) != 0 || status.st_size == 0) {
+        close(descriptor);
+        throw std::runtime_error("MappedFile : " + filePath.string() + " is empty");
+    }
+    length = static_cast<size_t>(status.st_size);
+    void* address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    // the mapping keeps its own reference to the file
+    close(descriptor);
+    if (address == MAP_FAILED) throw std::runtime_error("MappedFile : cannot map " + filePath.string());
+    mapping = static_cast<const unsigned char*>(address);
+}
+
+MappedFile::~MappedFile() { munmap(const_cast<unsigned char*>(mapping), length); }
+#endif
+}  // namespace util
@@ -0,0 +1,28 @@
+#pragma once
+#include <cstddef>
+
+#include "filesystem.h"
+
+namespace util {
+// Read-only memory mapping of a whole file, pages are read on first access and unmapped on destruction.
+class MappedFile final {
+ public:
+    // map filePath, throw std::runtime_error if it cannot be opened or is empty
+    explicit MappedFile(const fs::path& filePath);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // page aligned start of the file
+    const unsigned char* data() const { return mapping; }
+    size_t size() const { return length; }
+
+ private:
+    const unsigned char* mapping = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#endif
+};
+}  // namespace util
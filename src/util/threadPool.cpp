@@ -0,0 +1,167 @@
+#include "threadPool.h"
+
+#include <algorithm>
+
+namespace util {
+namespace {
+// pool and queue index of the worker running on this thread
+thread_local const ThreadPool* currentPool = nullptr;
+thread_local int currentWorker = -1;
+}  // namespace
+
+ThreadPool::ThreadPool(int workerCount) {
+    workers.reserve(std::max(workerCount, 0));
+    for (int i = 0; i < workerCount; ++i) taskQueues.emplace_back(std::make_unique<TaskQueue>());
+    for (int i = 0; i < workerCount; ++i) workers.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(jobLock);
+        stop = true;
+    }
+    cvJob.notify_all();
+    for (auto& worker : workers) worker.join();
+}
+
+ThreadPool& ThreadPool::getInstance() {
+    static ThreadPool pool(std::max(static_cast<int>(std::thread::hardware_concurrency()) - 1, 0));
+    return pool;
+}
+
+int ThreadPool::getThreadCount() const { return static_cast<int>(workers.size()) + 1; }
+
+void ThreadPool::run(Job& job) {
+    {
+        std::lock_guard<std::mutex> lock(jobLock);
+        job.next = jobs;
+        jobs = &job;
+    }
+    cvJob.notify_all();
+    while (executeChunk(job)) {
+    }
+    // Every chunk is claimed, unpublish so that no new helper can pick the job up.
+    {
+        std::lock_guard<std::mutex> lock(jobLock);
+        Job** link = &jobs;
+        while (*link != &job) link = &(*link)->next;
+        *link = job.next;
+    }
+    // Chunks still running on other threads, lend a hand to other jobs meanwhile.
+    while (job.finishedChunks.load(std::memory_order_acquire) != job.chunkCount ||
+           job.helpers.load(std::memory_order_acquire) != 0) {
+        if (!helpOnce()) std::this_thread::yield();
+    }
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    if (workers.empty()) {
+        task();
+        return;
+    }
+    const int index = currentPool == this ? currentWorker
+                                          : static_cast<int>(nextQueue.fetch_add(1, std::memory_order_relaxed) %
+                                                             workers.size());
+    {
+        std::lock_guard<std::mutex> lock(taskQueues[index]->lock);
+        taskQueues[index]->tasks.push_back(std::move(task));
+    }
+    queuedTasks.fetch_add(1, std::memory_order_release);
+    // A worker checks queuedTasks under jobLock before it sleeps, so it is either asleep or sees the task
+    { std::lock_guard<std::mutex> lock(jobLock); }
+    cvJob.notify_one();
+}
+
+bool ThreadPool::runPendingTask() {
+    std::function<void()> task;
+    if (!takeTask(currentPool == this ? currentWorker : -1, task)) return false;
+    task();
+    return true;
+}
+
+bool ThreadPool::takeTask(const int index, std::function<void()>& task) {
+    if (queuedTasks.load(std::memory_order_acquire) == 0) return false;
+    const int queueCount = static_cast<int>(taskQueues.size());
+    for (int i = 0; i < queueCount; ++i) {
+        const bool isOwn = index >= 0 && i == 0;
+        TaskQueue& queue = *taskQueues[index >= 0 ? (index + i) % queueCount : i];
+        std::lock_guard<std::mutex> lock(queue.lock);
+        if (queue.tasks.empty()) continue;
+        // the newest task of its own queue is the one most likely still in cache
+        if (isOwn) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        } else {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        queuedTasks.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::workerLoop(const int index) {
+    currentPool = this;
+    currentWorker = index;
+    while (true) {
+        Job* job = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(jobLock);
+            cvJob.wait(lock, [this, &job] {
+                job = findJob();
+                return stop || job != nullptr || queuedTasks.load(std::memory_order_acquire) > 0;
+            });
+            if (stop) return;
+            if (job != nullptr) job->helpers.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (job == nullptr) {
+            std::function<void()> task;
+            if (takeTask(index, task)) task();
+            continue;
+        }
+        while (executeChunk(*job)) {
+        }
+        job->helpers.fetch_sub(1, std::memory_order_release);
+    }
+}
+
+ThreadPool::Job* ThreadPool::findJob() {
+    for (Job* job = jobs; job != nullptr; job = job->next) {
+        if (job->nextChunk.load(std::memory_order_relaxed) < job->chunkCount) return job;
+    }
+    return nullptr;
+}
+
+bool ThreadPool::executeChunk(Job& job) {
+    const int chunk = job.nextChunk.fetch_add(1, std::memory_order_relaxed);
+    if (chunk >= job.chunkCount) return false;
+    const int chunkBegin = job.begin + chunk * job.grain;
+    const int chunkEnd = std::min(chunkBegin + job.grain, job.end);
+    job.invoke(job.context, chunkBegin, chunkEnd);
+    job.finishedChunks.fetch_add(1, std::memory_order_release);
+    return true;
+}
+
+bool ThreadPool::helpOnce() {
+    Job* job = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(jobLock);
+        job = findJob();
+        if (job == nullptr) return false;
+        job->helpers.fetch_add(1, std::memory_order_relaxed);
+    }
+    while (executeChunk(*job)) {
+    }
+    job->helpers.fetch_sub(1, std::memory_order_release);
+    return true;
+}
+
+// TaskGroup
+
+void TaskGroup::wait() {
+    while (pending.load(std::memory_order_acquire) != 0) {
+        if (!pool.runPendingTask()) std::this_thread::yield();
+    }
+}
+}  // namespace util
@@ -0,0 +1,124 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace util {
+// Fixed set of worker threads shared by the parallel loops and background tasks of the program.
+// parallelFor() publishes a job that lives on the caller's stack, so dispatching never allocates. The caller
+// executes chunks too and, while waiting for the job to drain, helps with other published jobs, which makes
+// nested parallelFor() calls safe.
+// submit() queues a task on one worker: its own queue when called from a worker, the next one in turn otherwise.
+// A worker runs the newest task of its queue and, when that is empty, steals the oldest task of another. Workers
+// take published parallelFor() chunks before any task, so background work never holds up a simulation step.
+class ThreadPool final {
+ public:
+    explicit ThreadPool(int workerCount);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // process-wide pool with one worker less than hardware threads, the caller being the last one
+    static ThreadPool& getInstance();
+
+    // number of threads that execute a parallelFor, the caller included
+    int getThreadCount() const;
+
+    // Call function(chunkBegin, chunkEnd) over [begin, end) split into chunks of at most grain indices.
+    template <typename Function>
+    void parallelFor(const int begin, const int end, const int grain, const Function& function) {
+        if (end - begin <= grain || workers.empty()) {
+            if (begin < end) function(begin, end);
+            return;
+        }
+        Job job;
+        job.begin = begin;
+        job.end = end;
+        job.grain = grain;
+        job.chunkCount = (end - begin + grain - 1) / grain;
+        job.invoke = [](const void* context, int chunkBegin, int chunkEnd) {
+            (*static_cast<const Function*>(context))(chunkBegin, chunkEnd);
+        };
+        job.context = &function;
+        run(job);
+    }
+
+    // Run task in the background, or right away on the caller when the pool has no worker. Tasks must not throw.
+    void submit(std::function<void()> task);
+    // run one queued task on the caller, return false if there is none
+    bool runPendingTask();
+
+ private:
+    struct Job {
+        int begin = 0;
+        int end = 0;
+        int grain = 1;
+        int chunkCount = 0;
+        std::atomic<int> nextChunk{0};
+        std::atomic<int> finishedChunks{0};
+        std::atomic<int> helpers{0};  // threads other than the owner holding a reference
+        void (*invoke)(const void*, int, int) = nullptr;
+        const void* context = nullptr;
+        Job* next = nullptr;
+    };
+
+    struct TaskQueue {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<TaskQueue>> taskQueues;  // one per worker
+    std::atomic<int> queuedTasks{0};
+    std::atomic<unsigned int> nextQueue{0};  // queue of the next task submitted from outside the pool
+    std::mutex jobLock;
+    std::condition_variable cvJob;
+    Job* jobs = nullptr;  // intrusive list of published jobs
+    bool stop = false;
+
+    void run(Job& job);
+    void workerLoop(int index);
+    // take the newest task of queue index, or steal the oldest task of another queue, index -1 only steals
+    bool takeTask(int index, std::function<void()>& task);
+    // must hold jobLock, return a published job that still has unclaimed chunks
+    Job* findJob();
+    // execute one chunk of job, return false when every chunk is claimed
+    static bool executeChunk(Job& job);
+    // try to take part in another published job, return false if there is none
+    bool helpOnce();
+};
+
+// Tasks submitted to a ThreadPool that can be waited for together. wait() runs queued tasks of the pool while
+// the group's own are unfinished; the group waits in its destructor too.
+class TaskGroup final {
+ public:
+    explicit TaskGroup(ThreadPool& pool = ThreadPool::getInstance()) : pool(pool) {}
+    ~TaskGroup() { wait(); }
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    template <typename Function>
+    void run(Function&& function) {
+        pending.fetch_add(1, std::memory_order_relaxed);
+        pool.submit([this, function = std::forward<Function>(function)]() mutable {
+            {
+                // destroyed before the count drops, the group may be gone right after
+                auto task = std::move(function);
+                task();
+            }
+            pending.fetch_sub(1, std::memory_order_release);
+        });
+    }
+    void wait();
+
+ private:
+    ThreadPool& pool;
+    std::atomic<int> pending{0};
+};
+}  // namespace util
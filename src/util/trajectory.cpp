@@ -0,0 +1,242 @@
+#include "trajectory.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+namespace util {
+namespace {
+// File layout, in the byte order of the machine that wrote it: a TrajectoryHeader, then every frame as a uint32
+// payload size, a keyframe flag byte and the payload, one zigzag varint per coordinate. Bump trajectoryVersion on
+// any change of the layout.
+constexpr char trajectoryMagic[8] = "SOFTTRJ";
+constexpr std::uint32_t trajectoryVersion = 1;
+constexpr std::uint32_t trajectoryByteOrder = 0x01020304;
+constexpr size_t frameHeaderSize = sizeof(std::uint32_t) + 1;
+
+struct TrajectoryHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byteOrder;
+    std::int32_t cubeCount;
+    std::int32_t particleCountPerEdge;
+    std::int32_t keyframeInterval;
+    float frameTime;
+    float precision;
+    std::uint32_t reserved;
+};
+static_assert(std::is_trivially_copyable<TrajectoryHeader>::value, "TrajectoryHeader is copied as raw bytes");
+
+// value in units of 1 / inverseStep, clamped into the int32 range, NaN becomes 0
+std::int32_t quantize(const float value, const float inverseStep) {
+    const float scaled = value * inverseStep;
+    if (std::isnan(scaled)) return 0;
+    return static_cast<std::int32_t>(std::lround(std::max(std::min(scaled, 2.0e9f), -2.0e9f)));
+}
+
+// Differences wrap around in unsigned arithmetic, so that adding one back restores any value exactly.
+std::int32_t difference(const std::int32_t a, const std::int32_t b) {
+    return static_cast<std::int32_t>(static_cast<std::uint32_t>(a) - static_cast<std::uint32_t>(b));
+}
+std::int32_t sum(const std::int32_t a, const std::int32_t b) {
+    return static_cast<std::int32_t>(static_cast<std::uint32_t>(a) + static_cast<std::uint32_t>(b));
+}
+
+void putVarint(std::int32_t value, std::vector<unsigned char>& bytes) {
+    // zigzag, small magnitudes of either sign become small codes
+    std::uint32_t code = (static_cast<std::uint32_t>(value) << 1) ^ static_cast<std::uint32_t>(value >> 31);
+    while (code >= 0x80) {
+        bytes.push_back(static_cast<unsigned char>(code | 0x80));
+        code >>= 7;
+    }
+    bytes.push_back(static_cast<unsigned char>(code));
+}
+
+// false if the varint runs past end
+bool getVarint(const unsigned char*& p, const unsigned char* end, std::int32_t& value) {
+    std::uint32_t code = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (p == end) return false;
+        const unsigned char byte = *p++;
+        code |= static_cast<std::uint32_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            value = static_cast<std::int32_t>((code >> 1) ^ (~(code & 1) + 1));
+            return true;
+        }
+    }
+    return false;
+}
+}  // namespace
+
+// TrajectoryWriter
+
+TrajectoryWriter::TrajectoryWriter(const fs::path& filePath, const TrajectoryInfo& _info) : info(_info) {
+    if (info.frameSize() <= 0 || !(info.precision > 0.0f) || info.keyframeInterval < 1) {
+        throw std::invalid_argument("TrajectoryWriter : invalid TrajectoryInfo");
+    }
+    file.open(filePath, std::ios::binary | std::ios::trunc);
+    if (!file) throw std::runtime_error("TrajectoryWriter : cannot open " + filePath.string());
+    TrajectoryHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, trajectoryMagic, sizeof(header.magic));
+    header.version = trajectoryVersion;
+    header.byteOrder = trajectoryByteOrder;
+    header.cubeCount = info.cubeCount;
+    header.particleCountPerEdge = info.particleCountPerEdge;
+    header.keyframeInterval = info.keyframeInterval;
+    header.frameTime = info.frameTime;
+    header.precision = info.precision;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    encoderThread = std::thread(&TrajectoryWriter::encodeLoop, this);
+}
+
+TrajectoryWriter::~TrajectoryWriter() { stopEncoder(); }
+
+void TrajectoryWriter::stopEncoder() {
+    if (!encoderThread.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(queueLock);
+        stop = true;
+    }
+    cvQueued.notify_one();
+    encoderThread.join();
+}
+
+void TrajectoryWriter::finish() {
+    stopEncoder();
+    if (failed.load()) throw std::runtime_error("TrajectoryWriter : cannot write the file, it is incomplete");
+}
+
+void TrajectoryWriter::write(const float* positions) {
+    if (!encoderThread.joinable()) throw std::logic_error("TrajectoryWriter::write : already finished");
+    if (failed.load()) throw std::runtime_error("TrajectoryWriter : cannot write the file");
+    std::vector<float> frame;
+    {
+        std::unique_lock<std::mutex> lock(queueLock);
+        cvTaken.wait(lock, [this] { return queue.size() < maxQueuedFrames; });
+        if (!spareFrames.empty()) {
+            frame = std::move(spareFrames.back());
+            spareFrames.pop_back();
+        }
+    }
+    frame.assign(positions, positions + info.frameSize());
+    {
+        std::lock_guard<std::mutex> lock(queueLock);
+        queue.push_back(std::move(frame));
+    }
+    cvQueued.notify_one();
+    ++frameCount;
+}
+
+void TrajectoryWriter::encodeLoop() {
+    const float inverseStep = 1.0f / info.precision;
+    std::vector<std::int32_t> previous(info.frameSize(), 0);
+    std::vector<unsigned char> bytes;
+    std::vector<float> frame;
+    for (int frameIdx = 0;; ++frameIdx) {
+        {
+            std::unique_lock<std::mutex> lock(queueLock);
+            cvQueued.wait(lock, [this] { return stop || !queue.empty(); });
+            // stop only once everything queued is written
+            if (queue.empty()) break;
+            frame = std::move(queue.front());
+            queue.pop_front();
+        }
+        cvTaken.notify_one();
+
+        const bool isKeyframe = frameIdx % info.keyframeInterval == 0;
+        bytes.assign(frameHeaderSize, 0);
+        for (size_t i = 0; i < frame.size(); ++i) {
+            const std::int32_t value = quantize(frame[i], inverseStep);
+            putVarint(isKeyframe ? value : difference(value, previous[i]), bytes);
+            previous[i] = value;
+        }
+        const std::uint32_t payloadSize = static_cast<std::uint32_t>(bytes.size() - frameHeaderSize);
+        std::memcpy(bytes.data(), &payloadSize, sizeof(payloadSize));
+        bytes[sizeof(payloadSize)] = isKeyframe;
+        if (!file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size())) failed.store(true);
+
+        std::lock_guard<std::mutex> lock(queueLock);
+        spareFrames.push_back(std::move(frame));
+    }
+    // closing flushes the buffered tail, which may fail as well
+    file.close();
+    if (file.fail()) failed.store(true);
+}
+
+// TrajectoryReader
+
+TrajectoryReader::TrajectoryReader(const fs::path& filePath) : file(filePath) {
+    const auto fail = [&filePath](const std::string& reason) {
+        throw std::runtime_error("TrajectoryReader : " + filePath.string() + " " + reason);
+    };
+    TrajectoryHeader header;
+    if (file.size() < sizeof(header)) fail("is not a trajectory");
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, trajectoryMagic, sizeof(header.magic)) != 0) fail("is not a trajectory");
+    if (header.byteOrder != trajectoryByteOrder) fail("was written with another byte order");
+    if (header.version != trajectoryVersion) {
+        fail("has version " + std::to_string(header.version) + ", expected " + std::to_string(trajectoryVersion));
+    }
+    const long long frameSize = 3LL * header.cubeCount * header.particleCountPerEdge * header.particleCountPerEdge *
+                                header.particleCountPerEdge;
+    if (header.cubeCount < 1 || header.particleCountPerEdge < 2 || frameSize > (1LL << 30) ||
+        header.keyframeInterval < 1 || !(header.precision > 0.0f)) {
+        fail("has an invalid header");
+    }
+    info.cubeCount = header.cubeCount;
+    info.particleCountPerEdge = header.particleCountPerEdge;
+    info.frameTime = header.frameTime;
+    info.precision = header.precision;
+    info.keyframeInterval = header.keyframeInterval;
+    quantized.resize(info.frameSize());
+
+    size_t offset = sizeof(header);
+    while (offset + frameHeaderSize <= file.size()) {
+        std::uint32_t payloadSize = 0;
+        std::memcpy(&payloadSize, file.data() + offset, sizeof(payloadSize));
+        if (payloadSize > file.size() - offset - frameHeaderSize) break;
+        frameOffsets.push_back(offset);
+        offset += frameHeaderSize + payloadSize;
+    }
+    if (!frameOffsets.empty() && !isKeyframe(0)) {
+        fail("does not start with a keyframe");
+    }
+}
+
+void TrajectoryReader::read(const int frame, float* positions) {
+    if (frame < 0 || frame >= getFrameCount()) throw std::out_of_range("TrajectoryReader::read : invalid frame");
+    if (frame != decodedFrame) {
+        // replay from the closest keyframe, or from the decoded frame when it comes before and no keyframe does
+        int first = frame;
+        while (!isKeyframe(first) && first != decodedFrame + 1) --first;
+        for (int f = first; f <= frame; ++f) decode(f);
+    }
+    for (size_t i = 0; i < quantized.size(); ++i) positions[i] = quantized[i] * info.precision;
+}
+
+bool TrajectoryReader::isKeyframe(const int frame) const {
+    return file.data()[frameOffsets[frame] + sizeof(std::uint32_t)] != 0;
+}
+
+void TrajectoryReader::decode(const int frame) {
+    const unsigned char* header = file.data() + frameOffsets[frame];
+    std::uint32_t payloadSize = 0;
+    std::memcpy(&payloadSize, header, sizeof(payloadSize));
+    const unsigned char* p = header + frameHeaderSize;
+    const unsigned char* end = p + payloadSize;
+    for (auto& value : quantized) {
+        std::int32_t code = 0;
+        if (!getVarint(p, end, code)) {
+            decodedFrame = -1;
+            throw std::runtime_error("TrajectoryReader : frame " + std::to_string(frame) + " is corrupted");
+        }
+        value = isKeyframe(frame) ? code : sum(value, code);
+    }
+    decodedFrame = frame;
+}
+}  // namespace util
@@ -0,0 +1,94 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "filesystem.h"
+#include "mappedFile.h"
+
+namespace util {
+// What a trajectory holds: frames of the positions of cubeCount cubes with particleCountPerEdge^3 particles each.
+struct TrajectoryInfo {
+    int cubeCount = 1;
+    int particleCountPerEdge = 10;
+    float frameTime = 0.0f;     // simulated seconds between frames
+    float precision = 0.001f;   // quantization step of the coordinates
+    int keyframeInterval = 60;  // frames between two self-contained frames
+
+    // floats of one frame, x y z interleaved particle after particle and cube after cube
+    int frameSize() const { return 3 * cubeCount * particleCountPerEdge * particleCountPerEdge * particleCountPerEdge; }
+};
+
+// Streams frames of particle positions to a file. Coordinates are quantized to info.precision, every
+// keyframeInterval-th frame stores them as is and the others store the difference to the previous frame, as
+// zigzag varints. write() only copies the frame; a background thread encodes and writes it.
+class TrajectoryWriter final {
+ public:
+    // create filePath and start the encoding thread, throw std::runtime_error if it cannot be created
+    TrajectoryWriter(const fs::path& filePath, const TrajectoryInfo& info);
+    // encode the frames still queued, then close the file, a failure goes unreported unless finish() ran first
+    ~TrajectoryWriter();
+    TrajectoryWriter(const TrajectoryWriter&) = delete;
+    TrajectoryWriter& operator=(const TrajectoryWriter&) = delete;
+
+    const TrajectoryInfo& getInfo() const { return info; }
+    int getFrameCount() const { return frameCount.load(); }
+
+    // Queue info.frameSize() floats, blocks only while the encoder is maxQueuedFrames behind. Throws
+    // std::runtime_error once a write to the file has failed.
+    void write(const float* positions);
+    // Encode the frames still queued and close the file, throw std::runtime_error if any write to it failed. No
+    // write() may follow.
+    void finish();
+
+ private:
+    static constexpr size_t maxQueuedFrames = 64;
+
+    TrajectoryInfo info;
+    std::ofstream file;
+    std::atomic<int> frameCount{0};
+    std::atomic<bool> failed{false};
+
+    std::mutex queueLock;
+    std::condition_variable cvQueued, cvTaken;
+    std::deque<std::vector<float>> queue;
+    std::vector<std::vector<float>> spareFrames;  // encoded frames whose storage write() reuses
+    bool stop = false;
+    std::thread encoderThread;
+
+    void encodeLoop();
+    // let the encoder drain the queue, then join it
+    void stopEncoder();
+};
+
+// Random access to the frames of a trajectory file, which is memory mapped. A file cut short by a crash of the
+// writer ends at its last complete frame.
+class TrajectoryReader final {
+ public:
+    // throw std::runtime_error if filePath is not a trajectory of this version and byte order
+    explicit TrajectoryReader(const fs::path& filePath);
+
+    const TrajectoryInfo& getInfo() const { return info; }
+    int getFrameCount() const { return static_cast<int>(frameOffsets.size()); }
+
+    // Decode frame into info.frameSize() floats. Consecutive frames cost one delta each, other frames decode
+    // from the closest keyframe before them.
+    void read(const int frame, float* positions);
+
+ private:
+    MappedFile file;
+    TrajectoryInfo info;
+    std::vector<size_t> frameOffsets;
+    std::vector<std::int32_t> quantized;  // coordinates of decodedFrame in units of info.precision
+    int decodedFrame = -1;
+
+    bool isKeyframe(const int frame) const;
+    // advance quantized to frame, which must be a keyframe or follow decodedFrame
+    void decode(const int frame);
+};
+}  // namespace util
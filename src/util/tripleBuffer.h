@@ -0,0 +1,38 @@
+#pragma once
+#include <atomic>
+
+namespace util {
+// Hands the newest value from one producer thread to one consumer thread without locks. Of the three buffers the
+// producer writes one, the consumer reads another and the third holds the latest published value, so neither side
+// ever waits for the other; values the consumer had no time to read are skipped.
+template <typename T>
+class TripleBuffer final {
+ public:
+    TripleBuffer() = default;
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+    // Producer side. back() may hold any older value, publish() makes it the newest one.
+    T& back() { return buffers[backIndex]; }
+    void publish() { backIndex = middle.exchange(backIndex | freshBit, std::memory_order_acq_rel) & indexMask; }
+
+    // Consumer side. update() moves front() to the newest published value and returns false if there is none
+    // since the last call; front() stays valid until the next update().
+    bool update() {
+        if ((middle.load(std::memory_order_relaxed) & freshBit) == 0) return false;
+        frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & indexMask;
+        return true;
+    }
+    const T& front() const { return buffers[frontIndex]; }
+
+ private:
+    // middle holds the index of the shared buffer, with freshBit set while it was not read yet
+    static constexpr int indexMask = 0b11;
+    static constexpr int freshBit = 0b100;
+
+    T buffers[3];
+    int backIndex = 0;
+    int frontIndex = 1;
+    std::atomic<int> middle{2};
+};
+}  // namespace util
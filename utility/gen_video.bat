@@ -1,9 +1,16 @@
 @ECHO OFF
 
 ::force overwrite
+IF EXIST ..\Screenshots\video.y4m (
+ffmpeg.exe -y ^
+-i ../Screenshots/video.y4m ^
+-c:v libx264 -qp 1 -profile:v high -preset fast -pix_fmt yuv420p ^
+result.mp4
+) ELSE (
 ffmpeg.exe -y ^
 -r 60 ^
--i ../Screenshots/%%3d.jpg ^
+-i ../Screenshots/%%06d.jpg ^
 -c:v libx264 -qp 1 -profile:v high444 -preset fast -pix_fmt yuv420p ^
 result.mp4
+)
 ECHO DONE!
\ No newline at end of file